@@ -16,26 +16,37 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <queue>
+#include <vector>
 #include <Kaleidoscope.h>
 #include "Kaleidoscope-Hardware-Virtual.h"
+#include "KeyLatency.h"
 #include "virtual_io.h"
+#include "virtual_clock.h"
+#include "physical_keys.h"
+#include "snapshot.h"
 #include <iostream>
-#include <sstream>
-#include <string>
+#include <string.h>
 
-Virtual::Virtual(void) 
-   :  _readMatrixEnabled(true)
+template <uint8_t rows_, uint8_t cols_>
+SIMULATION_LOCAL typename VirtualKeyboard<rows_, cols_>::MatrixState VirtualKeyboard<rows_, cols_>::_matrix;
+
+template <uint8_t rows_, uint8_t cols_>
+VirtualKeyboard<rows_, cols_>::VirtualKeyboard(void) 
 {
 }
 
-void Virtual::setup(void) {
-  for(byte row = 0; row < ROWS; row++) {
-    for(byte col = 0; col < COLS; col++) {
-      keystates[row][col] = NOT_PRESSED;
-      keystates_prev[row][col] = NOT_PRESSED;
-      mask[row][col] = false;
-    }
-  }
+template <uint8_t rows, uint8_t cols>
+static void loadEvents(void);
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::setup(void) {
+  _matrix.held.clear();
+  _matrix.tapped.clear();
+  _matrix.heldPrev.clear();
+  _matrix.masked.clear();
+  if(isFrameInput() && !checkFrameInputGeometry(rows, cols)) endSimulation(1);
+  if(isEventInput()) loadEvents<rows, cols>();
 }
 
 typedef enum {
@@ -44,215 +55,542 @@ typedef enum {
   M_UP,
 } Mode;
 
-bool Virtual::anythingHeld() {
-  for(byte row = 0; row < ROWS; row++) {
-    for(byte col = 0; col < COLS; col++) {
-      if(keystates[row][col] == PRESSED) return true;
-    }
-  }
-  return false;
-}
-
 typedef struct {
   uint8_t row;
   uint8_t col;
 } rc;
 
-static rc getRCfromPhysicalKey(std::string keyname);
+static rc getRCfromPhysicalKey(const InputSlice &keyname);
 
-void Virtual::readMatrix() {
-   
-   if(!_readMatrixEnabled) return;
-   
-  std::stringstream sline;
-  sline << getLineOfInput(anythingHeld());
+static bool isSeparator(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Splits the next token off the front of 'line', without copying it.
+// Returns false if there are no tokens left.
+static bool nextToken(InputSlice &line, InputSlice &token) {
+  const char* pos = line.data;
+  const char* end = line.data + line.length;
+  while(pos != end && isSeparator(*pos)) pos++;
+  if(pos == end) return false;
+  token.data = pos;
+  while(pos != end && !isSeparator(*pos)) pos++;
+  token.length = pos - token.data;
+  line.data = pos;
+  line.length = end - pos;
+  return true;
+}
+
+static bool tokenIs(const InputSlice &token, const char* str) {
+  return token.length == strlen(str) && memcmp(token.data, str, token.length) == 0;
+}
+
+// Parses the decimal number in [pos, end); false if it is empty, not a number, or over 'max'
+static bool parseNumber(const char* pos, const char* end, unsigned long &value, unsigned long max) {
+  if(pos == end) return false;
+  value = 0;
+  for(; pos != end; pos++) {
+    if(*pos < '0' || *pos > '9') return false;
+    value = value*10 + (*pos - '0');
+    if(value > max) return false;
+  }
+  return true;
+}
+
+// Parses a key given either as "(row,col)" or by its physical name.
+// If it isn't a valid key, prints an error (using 'unrecognized' for unknown names) and returns false.
+template <uint8_t rows, uint8_t cols>
+static bool parseKey(const InputSlice &token, rc &key, const char* unrecognized) {
+  const char* last = token.data + token.length - 1;
+  if(token.length >= 2 && token.data[0] == '(' && *last == ')') {
+    const char* comma = (const char*) memchr(token.data, ',', token.length);
+    if(!comma) {
+      std::cout << "Bad (r,c) pair: " << token << std::endl;
+      return false;
+    } else {
+      unsigned long row, col;
+      if(!parseNumber(token.data + 1, comma, row, rows - 1)
+          || !parseNumber(comma + 1, last, col, cols - 1)) {
+        std::cout << "Bad coordinates: " << token << std::endl;
+        return false;
+      }
+      key.row = row;
+      key.col = col;
+    }
+  } else {
+    key = getRCfromPhysicalKey(token);
+    if(!VirtualKeyboard<rows, cols>::getPhysicalKeyName(key.row, key.col)) {
+      std::cout << unrecognized << token << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool convertingScript = false;  // EXPECT can't be part of a frame script
+
+// Parses the rest of an EXPECT directive: "[within N cycles] keys NAME...", or "[within N cycles] none".
+// Returns false if it isn't valid.
+static bool parseExpectation(InputSlice line) {
+  InputSlice token;
+  unsigned long withinCycles = 0;
+  if(!nextToken(line, token)) return false;
+  if(tokenIs(token, "within")) {
+    InputSlice count;
+    if(!nextToken(line, count)
+        || !parseNumber(count.data, count.data + count.length, withinCycles, UINT32_MAX)
+        || !nextToken(line, token) || !(tokenIs(token, "cycles") || tokenIs(token, "cycle"))
+        || !nextToken(line, token)) {
+      return false;
+    }
+  }
+  HID_KeyboardReport_Data_t keys;
+  memset(keys.allkeys, 0, sizeof(keys.allkeys));
+  if(tokenIs(token, "keys")) {
+    bool any = false;
+    while(nextToken(line, token) && !tokenIs(token, "#")) {
+      if(!setKeyByName(keys, token.data, token.length)) {
+        std::cout << "Unrecognized key in EXPECT: " << token << std::endl;
+        return false;
+      }
+      any = true;
+    }
+    if(!any) return false;
+  } else if(tokenIs(token, "none")) {
+    if(nextToken(line, token) && !tokenIs(token, "#")) return false;
+  } else {
+    return false;
+  }
+  KeyboardExpectations.expect(keys, withinCycles);
+  return true;
+}
+
+// Applies the commands in one line of a text script to the 'held' and 'tap' key sets
+// (see VirtualKeyboard::setMatrixState()).  'waitCycles' is set to the
+// number of cycles the line lasts, which is 1 unless it has a 'W' command.
+// Returns false if the line asks to quit, in which case the rest of the line is ignored.
+template <uint8_t rows, uint8_t cols>
+static bool parseLineOfInput(InputSlice line, KeySet<rows, cols> &held, KeySet<rows, cols> &tap, unsigned &waitCycles) {
   Mode mode = M_TAP;
-  while(true) {
-    std::string token;
-    std::getline(sline, token, ' ');
-    if(token == "") break;  // end of line
-    else if(token == "#") break;  // skip the rest of the line
-    else if((token == "?" || token == "help") && isInteractive()) {
+  InputSlice token;
+  waitCycles = 1;
+  while(nextToken(line, token)) {
+    if(tokenIs(token, "#")) break;  // skip the rest of the line
+    else if((tokenIs(token, "?") || tokenIs(token, "help")) && isInteractive()) {
       printHelp();
-    } else if(token == "Q") {
-      exit(0);
-    } else if(token == "T") {
+    } else if(tokenIs(token, "Q")) {
+      return false;
+    } else if(tokenIs(token, "T")) {
       mode = M_TAP;
-    } else if(token == "D") {
+    } else if(tokenIs(token, "D")) {
       mode = M_DOWN;
-    } else if(token == "U") {
+    } else if(tokenIs(token, "U")) {
       mode = M_UP;
-    } else if(token == "C") {
-      for(byte row = 0; row < ROWS; row++) {
-        for(byte col = 0; col < COLS; col++) {
-          keystates[row][col] = NOT_PRESSED;
-        }
+    } else if(tokenIs(token, "W")) {
+      // Only a number is taken as the count; anything else is left to be read as a command
+      InputSlice count, rest = line;
+      unsigned long cycles;
+      if(!nextToken(rest, count)
+          || !parseNumber(count.data, count.data + count.length, cycles, UINT32_MAX)) {
+        std::cout << "Bad wait: W needs a number of cycles" << std::endl;
+        continue;
+      }
+      line = rest;
+      if(cycles > 1) waitCycles = cycles;
+    } else if(tokenIs(token, "EXPECT")) {
+      // The rest of the line belongs to the EXPECT
+      if(convertingScript) {
+        std::cout << "EXPECT can't be converted to a frame script" << std::endl;
+        exit(1);
+      }
+      if(!parseExpectation(line)) {
+        std::cout << "Bad EXPECT: " << line << std::endl;
+        if(!isInteractive()) endSimulation(1);
       }
+      break;
+    } else if(tokenIs(token, "C")) {
+      held.clear();
+      tap.clear();
     } else {
       rc key;
-      if(token.front() == '(' && token.back() == ')') {
-        size_t commapos = token.find_first_of(',');
-        if(commapos == std::string::npos) {
-          std::cout << "Bad (r,c) pair: " << token << std::endl;
-          continue;
-        } else {
-          key.row = std::stoi(token.substr(1,commapos-1));
-          key.col = std::stoi(token.substr(commapos+1,token.length()-commapos-1));
-          if(key.row >= ROWS || key.col >= COLS) {
-            std::cout << "Bad coordinates: " << token << std::endl;
-            continue;
-          }
-        }
-      } else {
-        key = getRCfromPhysicalKey(token);
-        if(key.row >= ROWS || key.col >= COLS) {
-          std::cout << "Unrecognized command: " << token << std::endl;
-          continue;
-        }
-      }
-      keystates[key.row][key.col] =
-        (mode == M_DOWN) ? PRESSED :
-        (mode == M_UP) ? NOT_PRESSED :
-        TAP;
+      if(!parseKey<rows, cols>(token, key, "Unrecognized command: ")) continue;
+      held.reset(key.row, key.col);
+      tap.reset(key.row, key.col);
+      if(mode == M_DOWN) held.set(key.row, key.col);
+      else if(mode == M_TAP) tap.set(key.row, key.col);
     }
   }
+  return true;
 }
 
-void Virtual::setKeystate(byte row, byte col, keystate ks)
-{
-   keystates[row][col] = ks;
+// Timed event scripts.  Each event sets one key's state at a given virtual time, and
+// the events wait in a queue ordered by time until the first scan at or after that time.
+typedef struct {
+  uint64_t time;  // in microseconds
+  uint32_t seq;  // position in the script, so that simultaneous events keep their order
+  rc key;  // {255,255} for an 'end' event, which only marks the end of the script
+  VirtualKeyboardBase::keystate state;
+} Event;
+
+struct LaterEvent {
+  bool operator()(const Event &a, const Event &b) const {
+    return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+  }
+};
+
+static SIMULATION_LOCAL std::priority_queue<Event, std::vector<Event>, LaterEvent> events;
+// A second event for the same key in one cycle would undo the first before the firmware
+// saw it, so it waits for the next cycle
+static SIMULATION_LOCAL std::vector<Event> deferredEvents;
+static SnapshotCopy<std::priority_queue<Event, std::vector<Event>, LaterEvent> > eventsInSnapshots(events);
+static SnapshotCopy<std::vector<Event> > deferredEventsInSnapshots(deferredEvents);
+
+// Parses a time such as "12.5ms", "40us" or "2s" (no unit means ms) into microseconds.
+static bool parseTime(InputSlice token, uint64_t &time) {
+  uint64_t unit = 1000;
+  if(token.length > 2 && tokenIs({token.data + token.length - 2, 2}, "us")) {
+    unit = 1;
+    token.length -= 2;
+  } else if(token.length > 2 && tokenIs({token.data + token.length - 2, 2}, "ms")) {
+    token.length -= 2;
+  } else if(token.length > 1 && token.data[token.length - 1] == 's') {
+    unit = 1000000;
+    token.length -= 1;
+  }
+  const char* end = token.data + token.length;
+  const char* point = (const char*) memchr(token.data, '.', token.length);
+  if(!point) point = end;
+  unsigned long whole, fraction = 0;
+  if(!parseNumber(token.data, point, whole, UINT32_MAX)) return false;
+  time = whole * unit;
+  if(point != end) {
+    // Digits beyond the resolution of a microsecond are dropped
+    uint64_t scale = unit;
+    for(const char* pos = point + 1; pos != end; pos++) {
+      if(*pos < '0' || *pos > '9') return false;
+      scale /= 10;
+      fraction += (*pos - '0') * scale;
+    }
+    if(point + 1 == end) return false;
+    time += fraction;
+  }
+  return true;
 }
 
-void Virtual::actOnMatrixScan() {
-  for (byte row = 0; row < ROWS; row++) {
-    for (byte col = 0; col < COLS; col++) {
-      uint8_t keyState = 0;
-      switch(keystates_prev[row][col]) {
-        case PRESSED:
-          keyState |= WAS_PRESSED;
-          break;
-        case TAP:
-          std::cerr << "Error: assertion failed, keystates_prev should not be TAP" << std::endl;
-          break;
-        case NOT_PRESSED:
-        default:
-          /* do nothing */
-          break;
+// Parses one line of an event script: one or more of "+key" (press), "-key" (release)
+// and "tap key", followed by "@time"; or "end @time".
+template <uint8_t rows, uint8_t cols>
+static void parseEventLine(InputSlice line, unsigned lineNumber) {
+  static SIMULATION_LOCAL uint32_t seq = 0;
+  Event lineEvents[rows*cols + 1];
+  unsigned count = 0;
+  bool timed = false;
+  uint64_t time = 0;
+  InputSlice token;
+  while(nextToken(line, token)) {
+    if(tokenIs(token, "#")) break;  // skip the rest of the line
+    if(timed) {
+      std::cout << "Line " << lineNumber << ": unexpected " << token << " after the time" << std::endl;
+      return;
+    }
+    if(token.data[0] == '@') {
+      if(!parseTime({token.data + 1, token.length - 1}, time)) {
+        std::cout << "Line " << lineNumber << ": bad time: " << token << std::endl;
+        return;
       }
-      switch(keystates[row][col]) {
-        case PRESSED:
-        case TAP:
-          keyState |= IS_PRESSED;
-          break;
-        case NOT_PRESSED:
-        default:
-          /* do nothing */
-          break;
+      timed = true;
+      continue;
+    }
+    if(count == rows*cols + 1) {
+      std::cout << "Line " << lineNumber << ": too many events" << std::endl;
+      return;
+    }
+    Event &event = lineEvents[count];
+    InputSlice keyname;
+    if(tokenIs(token, "end")) {
+      event.key = {255, 255};
+      count++;
+      continue;
+    } else if(tokenIs(token, "tap")) {
+      event.state = VirtualKeyboardBase::TAP;
+      if(!nextToken(line, keyname)) {
+        std::cout << "Line " << lineNumber << ": 'tap' needs a key" << std::endl;
+        return;
       }
-      handleKeyswitchEvent(Key_NoKey, row, col, keyState);
-      keystates_prev[row][col] = keystates[row][col];
-      if(keystates[row][col] == TAP) {
-        keyState = WAS_PRESSED & ~IS_PRESSED;
-        handleKeyswitchEvent(Key_NoKey, row, col, keyState);
-        keystates[row][col] = NOT_PRESSED;
-        keystates_prev[row][col] = NOT_PRESSED;
+    } else if(token.length > 1 && (token.data[0] == '+' || token.data[0] == '-')) {
+      event.state = (token.data[0] == '+') ? VirtualKeyboardBase::PRESSED : VirtualKeyboardBase::NOT_PRESSED;
+      keyname = {token.data + 1, token.length - 1};
+    } else {
+      std::cout << "Line " << lineNumber << ": unrecognized event: " << token << std::endl;
+      return;
+    }
+    if(!parseKey<rows, cols>(keyname, event.key, "Unrecognized key: ")) return;
+    count++;
+  }
+  if(count && !timed) {
+    std::cout << "Line " << lineNumber << ": events need a time, e.g. @12.5ms" << std::endl;
+    return;
+  }
+  for(unsigned i = 0; i < count; i++) {
+    lineEvents[i].time = time;
+    lineEvents[i].seq = seq++;
+    events.push(lineEvents[i]);
+  }
+}
+
+template <uint8_t rows, uint8_t cols>
+static void loadEvents(void) {
+  InputSlice line;
+  unsigned lineNumber = 0;
+  while(readLineOfInput(line)) parseEventLine<rows, cols>(line, ++lineNumber);
+}
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::readMatrix() {
+   
+   if(_matrix.readMatrixDisabled) return;
+   
+  if(isFrameInput()) {
+    readMatrixFrame();
+    return;
+  }
+  if(isEventInput()) {
+    readMatrixEvents();
+    return;
+  }
+
+  KeyboardExpectations.checkDeadlines();
+
+  // The rest of a 'W' wait: keep the current state, without reading any input
+  if(takeIdleCycle()) {
+    if(!anythingHeld() && canSkipIdleCycles()) skipRestOfIdleCycles();
+    return;
+  }
+
+  unsigned waitCycles;
+  if(!parseLineOfInput(getLineOfInput(anythingHeld()), _matrix.held, _matrix.tapped, waitCycles)) endOfScript();
+  addIdleCycles(waitCycles - 1);
+}
+
+// Fast path for binary matrix-frame scripts: no parsing, just copy the frame
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::readMatrixFrame() {
+  const uint64_t *held, *tap;
+  getFrameOfInput(held, tap);
+  for(unsigned i = 0; i < Keys::words; i++) {
+    _matrix.held.word[i] = held[i] & ~tap[i];
+    _matrix.tapped.word[i] = tap[i];
+  }
+}
+
+// Dispatches the events that are due by the start of this scan cycle
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::readMatrixEvents() {
+  if(events.empty()) endOfScript();
+  uint64_t now = virtualMicros();
+  Keys touched;
+  touched.clear();
+  bool anyTouched = false;
+  while(!events.empty() && events.top().time <= now) {
+    Event event = events.top();
+    events.pop();
+    if(event.key.row >= rows) continue;  // 'end'
+    if(touched.test(event.key.row, event.key.col)) {
+      deferredEvents.push_back(event);
+      continue;
+    }
+    touched.set(event.key.row, event.key.col);
+    anyTouched = true;
+    setKeystate(event.key.row, event.key.col, event.state);
+  }
+  for(size_t i = 0; i < deferredEvents.size(); i++) events.push(deferredEvents[i]);
+  deferredEvents.clear();
+
+  // If the firmware is idle, the cycles before the one that dispatches the next event
+  // can't change anything
+  if(!anyTouched && !events.empty() && !anythingHeld() && canSkipIdleCycles()) {
+    uint64_t period = scanPeriodMicros();
+    uint64_t cycles = (events.top().time - now + period - 1) / period;  // until the next event
+    if(cycles > 1) skipIdleCycles(cycles - 1 > UINT32_MAX ? UINT32_MAX : cycles - 1);
+  }
+}
+
+bool nextScriptCommand(InputSlice &line, InputSlice &command, bool &expectation) {
+  InputSlice token;
+  if(!nextToken(line, token) || tokenIs(token, "#")) return false;
+  command = token;
+  expectation = tokenIs(token, "EXPECT");
+  if(expectation) {
+    // The rest of the line belongs to the EXPECT
+    command.length = line.data + line.length - token.data;
+    line.data += line.length;
+    line.length = 0;
+  } else if(tokenIs(token, "W")) {
+    // As in parseLineOfInput(), only a number is the count
+    InputSlice count, rest = line;
+    unsigned long cycles;
+    if(nextToken(rest, count) && parseNumber(count.data, count.data + count.length, cycles, UINT32_MAX)) {
+      command.length = count.data + count.length - token.data;
+      line = rest;
+    }
+  }
+  return true;
+}
+
+bool convertScript(const char* textfile, const char* framefile) {
+  if(!openScript(textfile)) return false;
+  if(isFrameInput()) {
+    std::cerr << "Error: \"" << textfile << "\" is already a frame script" << std::endl;
+    return false;
+  }
+  if(!openFrameOutput(framefile, ROWS, COLS)) return false;
+  convertingScript = true;
+
+  Virtual::Keys held, tap;
+  held.clear();
+  tap.clear();
+  InputSlice line;
+  unsigned waitCycles;
+  while(readLineOfInput(line)) {
+    if(!parseLineOfInput(line, held, tap, waitCycles)) break;
+    putFrameOfOutput(held.word, tap.word);
+    tap.clear();  // taps only last one cycle
+    if(waitCycles > 1) putFrameOfOutput(held.word, tap.word, waitCycles - 1);
+  }
+
+  return closeFrameOutput();
+}
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::setKeystate(byte row, byte col, keystate ks)
+{
+  _matrix.held.reset(row, col);
+  _matrix.tapped.reset(row, col);
+  if(ks == PRESSED) _matrix.held.set(row, col);
+  else if(ks == TAP) _matrix.tapped.set(row, col);
+}
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::setMatrixState(const Keys &held, const Keys &tap) {
+  for(unsigned i = 0; i < Keys::words; i++) {
+    _matrix.held.word[i] = held.word[i] & ~tap.word[i];
+    _matrix.tapped.word[i] = tap.word[i];
+  }
+}
+
+template <uint8_t rows_, uint8_t cols_>
+inline void VirtualKeyboard<rows_, cols_>::actOnKey(byte row, byte col, unsigned word, uint64_t bit) {
+  uint8_t keyState = 0;
+  if(_matrix.heldPrev.word[word] & bit) keyState |= WAS_PRESSED;
+  if((_matrix.held.word[word] | _matrix.tapped.word[word]) & bit) keyState |= IS_PRESSED;
+  handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+  if(_matrix.tapped.word[word] & bit) {
+    keyState = WAS_PRESSED & ~IS_PRESSED;
+    handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+  }
+}
+
+// Tells the latency analyzer about this scan's presses and releases.  A tap is both.
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::noteKeyChanges() {
+  uint8_t layer = Layer.top();
+  for(unsigned word = 0; word < Keys::words; word++) {
+    uint64_t pressed = (_matrix.held.word[word] | _matrix.tapped.word[word]) & ~_matrix.heldPrev.word[word];
+    uint64_t released = (_matrix.heldPrev.word[word] & ~_matrix.held.word[word]) | _matrix.tapped.word[word];
+    for(; pressed; pressed &= pressed - 1) {
+      unsigned i = word*64 + __builtin_ctzll(pressed);
+      KeyLatency.keyChanged(i / cols, i % cols, true, layer);
+    }
+    for(; released; released &= released - 1) {
+      unsigned i = word*64 + __builtin_ctzll(released);
+      KeyLatency.keyChanged(i / cols, i % cols, false, layer);
+    }
+  }
+}
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::actOnMatrixScan() {
+  if(isLatencyAnalysis()) noteKeyChanges();
+  if(isSparseScan()) {
+    // Only keys that are pressed now or were in the last scan have anything to report.
+    // Visiting them lowest bit first keeps the full scan's row-major order.
+    for(unsigned word = 0; word < Keys::words; word++) {
+      uint64_t active = _matrix.held.word[word] | _matrix.tapped.word[word] | _matrix.heldPrev.word[word];
+      while(active) {
+        unsigned i = word*64 + __builtin_ctzll(active);
+        actOnKey(i / cols, i % cols, word, active & -active);
+        active &= active - 1;
       }
     }
+  } else {
+    scanKeys(KeyIndex<0>());
   }
+  // Taps last just this one scan; after it, tapped keys are released
+  _matrix.heldPrev = _matrix.held;
+  _matrix.tapped.clear();
+}
+
+// FNV-1a.  It is constexpr so that the lookup below can use the hashes of the key names
+// as case labels: the compiler then builds the lookup, and rejects any collision between
+// two names as a duplicate case, so the hash is guaranteed perfect for this set of keys.
+static constexpr uint32_t physicalKeyHash(const char* str, size_t length, uint32_t hash = 2166136261u) {
+  return length == 0 ? hash : physicalKeyHash(str + 1, length - 1, (hash ^ (uint8_t)*str) * 16777619u);
 }
 
-static rc getRCfromPhysicalKey(std::string keyname) {
-  if(keyname == "prog") return {0,0};
-  else if(keyname == "1") return {0,1};
-  else if(keyname == "2") return {0,2};
-  else if(keyname == "3") return {0,3};
-  else if(keyname == "4") return {0,4};
-  else if(keyname == "5") return {0,5};
-  else if(keyname == "led") return {0,6};
-  else if(keyname == "any") return {0,9};
-  else if(keyname == "6") return {0,10};
-  else if(keyname == "7") return {0,11};
-  else if(keyname == "8") return {0,12};
-  else if(keyname == "9") return {0,13};
-  else if(keyname == "0") return {0,14};
-  else if(keyname == "num") return {0,15};
-  else if(keyname == "`") return {1,0};
-  else if(keyname == "q") return {1,1};
-  else if(keyname == "w") return {1,2};
-  else if(keyname == "e") return {1,3};
-  else if(keyname == "r") return {1,4};
-  else if(keyname == "t") return {1,5};
-  else if(keyname == "tab") return {1,6};
-  else if(keyname == "enter") return {1,9};
-  else if(keyname == "y") return {1,10};
-  else if(keyname == "u") return {1,11};
-  else if(keyname == "i") return {1,12};
-  else if(keyname == "o") return {1,13};
-  else if(keyname == "p") return {1,14};
-  else if(keyname == "=") return {1,15};
-  else if(keyname == "pgup") return {2,0};
-  else if(keyname == "a") return {2,1};
-  else if(keyname == "s") return {2,2};
-  else if(keyname == "d") return {2,3};
-  else if(keyname == "f") return {2,4};
-  else if(keyname == "g") return {2,5};
-  else if(keyname == "h") return {2,10};
-  else if(keyname == "j") return {2,11};
-  else if(keyname == "k") return {2,12};
-  else if(keyname == "l") return {2,13};
-  else if(keyname == ";") return {2,14};
-  else if(keyname == "'") return {2,15};
-  else if(keyname == "pgdn") return {3,0};
-  else if(keyname == "z") return {3,1};
-  else if(keyname == "x") return {3,2};
-  else if(keyname == "c") return {3,3};
-  else if(keyname == "v") return {3,4};
-  else if(keyname == "b") return {3,5};
-  else if(keyname == "esc") return {2,6};  // yes, row 2
-  else if(keyname == "fly") return {2,9};  // yes, row 2
-  else if(keyname == "n") return {3,10};
-  else if(keyname == "m") return {3,11};
-  else if(keyname == ",") return {3,12};
-  else if(keyname == ".") return {3,13};
-  else if(keyname == "/") return {3,14};
-  else if(keyname == "-") return {3,15};
-  else if(keyname == "lctrl") return {0,7};
-  else if(keyname == "bksp") return {1,7};
-  else if(keyname == "cmd") return {2,7};
-  else if(keyname == "lshift") return {3,7};
-  else if(keyname == "rshift") return {3,8};
-  else if(keyname == "alt") return {2,8};
-  else if(keyname == "space") return {1,8};
-  else if(keyname == "rctrl") return {0,8};
-  else if(keyname == "lfn") return {3,6};
-  else if(keyname == "rfn") return {3,9};
+static rc getRCfromPhysicalKey(const InputSlice &keyname) {
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < keyname.length; i++) hash = (hash ^ (uint8_t)keyname.data[i]) * 16777619u;
+  switch(hash) {
+#define PHYSICAL_KEY(name, row, col) \
+    case physicalKeyHash(name, sizeof(name) - 1): \
+      if(tokenIs(keyname, name)) return {row, col}; \
+      break;
+    FOREACH_PHYSICAL_KEY(PHYSICAL_KEY)
+#undef PHYSICAL_KEY
+  }
   return {255,255};
 }
 
-void Virtual::maskKey(byte row, byte col) {
-  if (row >= ROWS || col >= COLS)
+template <uint8_t rows_, uint8_t cols_>
+const char* VirtualKeyboard<rows_, cols_>::getPhysicalKeyName(byte row, byte col) {
+  if (rows != 4 || cols != 16 || row >= rows || col >= cols)
+    return NULL;
+  switch(row*16 + col) {
+#define PHYSICAL_KEY(name, row, col) \
+    case row*16 + col: return name;
+    FOREACH_PHYSICAL_KEY(PHYSICAL_KEY)
+#undef PHYSICAL_KEY
+  }
+  return NULL;
+}
+
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::maskKey(byte row, byte col) {
+  if (row >= rows || col >= cols)
     return;
-  mask[row][col] = true;
+  _matrix.masked.set(row, col);
 }
 
-void Virtual::unMaskKey(byte row, byte col) {
-  if (row >= ROWS || col >= COLS)
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::unMaskKey(byte row, byte col) {
+  if (row >= rows || col >= cols)
     return;
-  mask[row][col] = false;
+  _matrix.masked.reset(row, col);
 }
 
-bool Virtual::isKeyMasked(byte row, byte col) {
-  if (row >= ROWS || col >= COLS)
+template <uint8_t rows_, uint8_t cols_>
+bool VirtualKeyboard<rows_, cols_>::isKeyMasked(byte row, byte col) {
+  if (row >= rows || col >= cols)
     return false;
-  return mask[row][col];
+  return _matrix.masked.test(row, col);
 }
 
-void Virtual::maskHeldKeys(void) {
-  for(byte row = 0; row < ROWS; row++) {
-    for(byte col = 0; col < COLS; col++) {
-      mask[row][col] = (keystates[row][col] == PRESSED);
-    }
-  }
+template <uint8_t rows_, uint8_t cols_>
+void VirtualKeyboard<rows_, cols_>::maskHeldKeys(void) {
+  _matrix.masked = _matrix.held;
 }
 
+// Only the geometry this sketch is built for is compiled
+template class VirtualKeyboard<ROWS, COLS>;
+
 HARDWARE_IMPLEMENTATION KeyboardHardware;
@@ -19,10 +19,21 @@
 #pragma once
 
 #include <Arduino.h>
+#include <string.h>
+#include "simulation.h"
 #define HARDWARE_IMPLEMENTATION Virtual
 
-#define COLS 16
-#define ROWS 4
+// The matrix geometry is chosen at build time (see the "Matrix" menu in boards.txt);
+// the default is the Model 01's 4x16
+#ifndef VIRTUAL_ROWS
+#define VIRTUAL_ROWS 4
+#endif
+#ifndef VIRTUAL_COLS
+#define VIRTUAL_COLS 16
+#endif
+
+#define COLS VIRTUAL_COLS
+#define ROWS VIRTUAL_ROWS
 #define LED_COUNT 0
 
 typedef struct {
@@ -33,16 +44,44 @@ typedef struct {
 
 #define CRGB(r, g, b) (cRGB){r, g, b}
 
-class Virtual {
+// A set of keys on a rows x cols matrix, one bit per key: key (row,col) is bit
+// (row*cols + col), packed into as many 64-bit words as that takes
+template <uint8_t rows, uint8_t cols>
+struct KeySet {
+  static constexpr unsigned words = (rows * cols + 63) / 64;
+  uint64_t word[words];
+
+  static unsigned index(byte row, byte col) { return row*cols + col; }
+  bool test(byte row, byte col) const {
+    return word[index(row, col) / 64] & ((uint64_t)1 << (index(row, col) % 64));
+  }
+  void set(byte row, byte col) { word[index(row, col) / 64] |= (uint64_t)1 << (index(row, col) % 64); }
+  void reset(byte row, byte col) { word[index(row, col) / 64] &= ~((uint64_t)1 << (index(row, col) % 64)); }
+  void clear(void) { memset(word, 0, sizeof(word)); }
+  bool any(void) const {
+    for (unsigned i = 0; i < words; i++) if (word[i]) return true;
+    return false;
+  }
+};
+
+// The geometry-independent part of VirtualKeyboard
+struct VirtualKeyboardBase {
+  typedef enum {
+    PRESSED,
+    NOT_PRESSED,
+    TAP,
+  } keystate;
+};
+
+template <uint8_t rows_, uint8_t cols_>
+class VirtualKeyboard : public VirtualKeyboardBase {
   public:
-     
-    typedef enum {
-      PRESSED,
-      NOT_PRESSED,
-      TAP,
-    } keystate;
-    
-    Virtual(void);
+
+    static constexpr uint8_t rows = rows_;
+    static constexpr uint8_t cols = cols_;
+    typedef KeySet<rows_, cols_> Keys;
+
+    VirtualKeyboard(void);
     void setup(void);
 
     void readMatrix(void);
@@ -62,23 +101,53 @@ class Virtual {
       actOnMatrixScan();
     }
     
-    void setEnableReadMatrix(bool state) { _readMatrixEnabled = state; }
+    void setEnableReadMatrix(bool state) { _matrix.readMatrixDisabled = !state; }
     
     void setKeystate(byte row, byte col, keystate ks);
 
+    // Bulk access to the whole matrix: 'held' keys stay pressed until released, 'tap' keys
+    // are pressed for this scan cycle only
+    void setMatrixState(const Keys &held, const Keys &tap);
+    const Keys &getHeldKeys(void) const { return _matrix.held; }
+
+    // The key's "physical" name (as used in scripts), or NULL if it has none.  Only the
+    // Model 01's 4x16 matrix has physical names; other geometries use (r,c) pairs.
+    static const char* getPhysicalKeyName(byte row, byte col);
+
   private:
 
-    keystate keystates[ROWS][COLS];
-    keystate keystates_prev[ROWS][COLS];  
-    
-    bool _readMatrixEnabled;
+    // The matrix state belongs to the simulation, not to KeyboardHardware, which Kaleidoscope
+    // declares as a plain global; so it is kept here, where it can be SIMULATION_LOCAL
+    struct MatrixState {
+      Keys held;  // keys that are PRESSED
+      Keys tapped;  // keys that are TAP
+      Keys heldPrev;  // keys that were pressed as of the previous scan
+      Keys masked;
+      bool readMatrixDisabled;
+    };
+    static SIMULATION_LOCAL MatrixState _matrix;
 
-    bool anythingHeld();
+    bool anythingHeld() const { return _matrix.held.any(); }
+    void readMatrixFrame(void);
+    void readMatrixEvents(void);
+    void actOnKey(byte row, byte col, unsigned word, uint64_t bit);
+    void noteKeyChanges(void);
 
-    // Super inefficient, but fine for our purposes
-    bool mask[ROWS][COLS];
+    // The full scan, unrolled at compile time: scanKeys(KeyIndex<0>()) visits every key
+    // in row-major order, with each key's row, column and bit all constants
+    template <unsigned key> struct KeyIndex {};
+    void scanKeys(KeyIndex<rows_ * cols_>) {}
+    template <unsigned key>
+    __attribute__((always_inline)) void scanKeys(KeyIndex<key>) {
+      actOnKey(key / cols_, key % cols_, key / 64, (uint64_t)1 << (key % 64));
+      scanKeys(KeyIndex<key + 1>());
+    }
 };
 
+typedef VirtualKeyboard<VIRTUAL_ROWS, VIRTUAL_COLS> Virtual;
+
+// These keymap macros are for the Model 01 layout; sketches for other geometries give their
+// keymaps as plain arrays of ROWS rows of COLS keys
 #define KEYMAP_STACKED(                                                 \
                r0c0, r0c1, r0c2, r0c3, r0c4, r0c5, r0c6,                \
                r1c0, r1c1, r1c2, r1c3, r1c4, r1c5, r1c6,                \
@@ -0,0 +1,197 @@
+#include <vector>
+#include <algorithm>
+#include "KeyLatency.h"
+#include "Kaleidoscope-Hardware-Virtual.h"
+#include "virtual_io.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include "virtual_clock.h"
+#include <stdio.h>
+
+typedef struct {
+  uint32_t cycles;
+  uint32_t micros;
+} Sample;
+
+typedef struct {
+  uint16_t key;  // row * COLS + col
+  bool pressed;
+  uint8_t layer;
+  unsigned cycle;
+  uint64_t time;
+} Transition;
+
+// Samples are kept per key and per layer, each split into presses [0] and releases [1]
+static SIMULATION_LOCAL std::vector<Sample> keySamples[ROWS * COLS][2];
+static SIMULATION_LOCAL std::vector<std::vector<Sample> > layerSamples[2];
+static SIMULATION_LOCAL std::vector<Transition> pending;
+static SnapshotCopy<std::vector<Sample>[ROWS * COLS][2]> keySamplesInSnapshots(keySamples);
+static SnapshotCopy<std::vector<std::vector<Sample> >[2]> layerSamplesInSnapshots(layerSamples);
+static SnapshotCopy<std::vector<Transition> > pendingInSnapshots(pending);
+
+// What each key added to a report the last time that could be told apart from what any
+// other key did; all zeros until then
+static SIMULATION_LOCAL HID_KeyboardReport_Data_t keyUsages[ROWS * COLS];
+
+static bool isEmpty(const HID_KeyboardReport_Data_t &keys) {
+  for(size_t i = 0; i < sizeof(keys.allkeys); i++) {
+    if(keys.allkeys[i]) return false;
+  }
+  return true;
+}
+
+// TRUE if 'keys' holds all of 'usages', and 'usages' isn't empty
+static bool contains(const HID_KeyboardReport_Data_t &keys, const HID_KeyboardReport_Data_t &usages) {
+  for(size_t i = 0; i < sizeof(keys.allkeys); i++) {
+    if(usages.allkeys[i] & ~keys.allkeys[i]) return false;
+  }
+  return !isEmpty(usages);
+}
+
+static unsigned countKeys(const HID_KeyboardReport_Data_t &keys) {
+  unsigned count = 0;
+  for(size_t i = 0; i < sizeof(keys.allkeys); i++) count += __builtin_popcount(keys.allkeys[i]);
+  return count;
+}
+
+static void addSample(const Transition &transition, unsigned cycle, uint64_t time) {
+  Sample sample;
+  sample.cycles = cycle - transition.cycle;
+  sample.micros = time - transition.time;
+  unsigned release = !transition.pressed;
+  keySamples[transition.key][release].push_back(sample);
+  if(layerSamples[release].size() <= transition.layer) layerSamples[release].resize(transition.layer + 1);
+  layerSamples[release][transition.layer].push_back(sample);
+}
+
+KeyLatencyReportConsumer::KeyLatencyReportConsumer(void)
+  :  _started(false)
+{
+  memset(_hostKeys.allkeys, 0, sizeof(_hostKeys.allkeys));
+}
+
+void KeyLatencyReportConsumer::keyChanged(uint8_t row, uint8_t col, bool pressed, uint8_t layer) {
+  // Reports reach this consumer from the first key on
+  if(!_started) {
+    _started = true;
+    _hostKeys = Keyboard.getLastKeyReport();
+    HIDReports.addConsumer(*this);
+  }
+  Transition transition;
+  transition.key = row * COLS + col;
+  transition.pressed = pressed;
+  transition.layer = layer;
+  transition.cycle = currentCycle();
+  transition.time = virtualMicros();
+  pending.push_back(transition);
+}
+
+void KeyLatencyReportConsumer::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  // What the report added [0] and took away [1], for presses and releases respectively
+  HID_KeyboardReport_Data_t changed[2];
+  for(size_t i = 0; i < sizeof(reportData.allkeys); i++) {
+    changed[0].allkeys[i] = reportData.allkeys[i] & ~_hostKeys.allkeys[i];
+    changed[1].allkeys[i] = _hostKeys.allkeys[i] & ~reportData.allkeys[i];
+  }
+  _hostKeys = reportData;
+  if(isEmpty(changed[0]) && isEmpty(changed[1])) return;
+
+  // First the keys whose own usages the report added or took away, each of which accounts
+  // for those usages
+  std::vector<bool> matched(pending.size(), false);
+  for(size_t i = 0; i < pending.size(); i++) {
+    const HID_KeyboardReport_Data_t &usages = keyUsages[pending[i].key];
+    HID_KeyboardReport_Data_t &left = changed[!pending[i].pressed];
+    if(!contains(left, usages)) continue;
+    matched[i] = true;
+    for(size_t j = 0; j < sizeof(left.allkeys); j++) left.allkeys[j] &= ~usages.allkeys[j];
+  }
+
+  // Then, for what no such key accounts for, the latest presses or releases, one per usage.
+  // A key still waiting from before them is more likely one whose effect a plugin holds
+  // back (a dual-function key, say) than one whose report is late.  A press that is the
+  // only one waiting is known to be the cause, and its usages are learnt for next time.
+  unsigned left[2] = { countKeys(changed[0]), countKeys(changed[1]) };
+  unsigned waiting[2] = { 0, 0 };
+  for(size_t i = 0; i < pending.size(); i++) waiting[!pending[i].pressed] += !matched[i];
+  for(size_t i = pending.size(); i--; ) {
+    unsigned release = !pending[i].pressed;
+    if(matched[i] || !left[release]) continue;
+    if(!release && waiting[0] == 1) keyUsages[pending[i].key] = changed[0];
+    matched[i] = true;
+    left[release]--;
+  }
+
+  unsigned cycle = currentCycle();
+  uint64_t time = virtualMicros();
+  size_t kept = 0;
+  for(size_t i = 0; i < pending.size(); i++) {
+    if(matched[i]) addSample(pending[i], cycle, time);
+    else pending[kept++] = pending[i];
+  }
+  pending.resize(kept);
+}
+
+static bool fewerCycles(const Sample &a, const Sample &b) { return a.cycles < b.cycles; }
+static bool fewerMicros(const Sample &a, const Sample &b) { return a.micros < b.micros; }
+
+// Nearest-rank percentile of samples sorted by 'field'
+static uint32_t percentile(const std::vector<Sample> &sorted, unsigned percent, uint32_t Sample::*field) {
+  size_t rank = (sorted.size() * percent + 99) / 100;
+  return sorted[rank ? rank - 1 : 0].*field;
+}
+
+static void writeRow(FILE* out, const char* name, const char* event, std::vector<Sample> &samples) {
+  if(samples.empty()) return;
+  fprintf(out, "  %-12s %-8s %8zu", name, event, samples.size());
+  std::sort(samples.begin(), samples.end(), fewerCycles);
+  fprintf(out, "   %6u %6u %6u", percentile(samples, 50, &Sample::cycles),
+          percentile(samples, 99, &Sample::cycles), samples.back().cycles);
+  std::sort(samples.begin(), samples.end(), fewerMicros);
+  fprintf(out, "   %9u %9u %9u\n", percentile(samples, 50, &Sample::micros),
+          percentile(samples, 99, &Sample::micros), samples.back().micros);
+}
+
+static void writeHeader(FILE* out, const char* what) {
+  fprintf(out, "\nPer %s:\n  %-12s %-8s %8s   %6s %6s %6s   %9s %9s %9s\n", what, what, "event", "count",
+          "cyc50", "cyc99", "cycmax", "us50", "us99", "usmax");
+}
+
+void KeyLatencyReportConsumer::finish(void) {
+  FILE* out = openResultsFile("latency.txt");
+  if(!out) {
+    fprintf(stderr, "Error opening results/latency.txt\n");
+    return;
+  }
+  static const char* const events[2] = { "press", "release" };
+  fprintf(out, "Key-to-report latency, in scan cycles and microseconds of virtual time.  A press is\n"
+               "measured to the first keyboard report that adds its key, a release to the first that\n"
+               "removes it.\n");
+
+  writeHeader(out, "key");
+  for(unsigned key = 0; key < ROWS * COLS; key++) {
+    uint8_t row = key / COLS, col = key % COLS;
+    char name[16];
+    const char* physical = Virtual::getPhysicalKeyName(row, col);
+    if(physical) snprintf(name, sizeof(name), "%s", physical);
+    else snprintf(name, sizeof(name), "(%u,%u)", row, col);
+    for(unsigned release = 0; release < 2; release++) writeRow(out, name, events[release], keySamples[key][release]);
+  }
+
+  writeHeader(out, "layer");
+  for(unsigned release = 0; release < 2; release++) {
+    for(size_t layer = 0; layer < layerSamples[release].size(); layer++) {
+      char name[16];
+      snprintf(name, sizeof(name), "%u", (unsigned)layer);  // layers are uint8_t
+      writeRow(out, name, events[release], layerSamples[release][layer]);
+    }
+  }
+
+  if(!pending.empty()) fprintf(out, "\n%zu press(es) and release(s) never reached a report.\n", pending.size());
+  closeResultsFile(out);
+}
+
+SIMULATION_LOCAL KeyLatencyReportConsumer KeyLatency;
+
+static void finishKeyLatency(void) { if(isLatencyAnalysis()) KeyLatency.finish(); }
+static AtSimulationEnd keyLatencyAtEnd(finishKeyLatency);
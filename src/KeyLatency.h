@@ -0,0 +1,33 @@
+#pragma once
+
+#include "VirtualHID/HIDReportConsumer.h"
+
+// The key-to-report latency analyzer (--latency).  The virtual hardware tells it about each
+// press and release it injects, with the layer on top at the time, and it measures the scan
+// cycles and virtual time until a keyboard report shows the effect: for a press, the first
+// report that adds the key's usages (keys or modifiers), and for a release, the first one
+// that takes them away.  Which usages a key has is learnt from a report that adds
+// something while its press is the only one waiting.  Until then, and for any usages no
+// waiting key is known to have, the match is a heuristic: the latest presses (or releases)
+// are taken to have caused them, one per usage.  At exit, the distribution (p50/p99/max)
+// per key and per layer goes to results/latency.txt.
+class KeyLatencyReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      KeyLatencyReportConsumer(void);
+
+      void keyChanged(uint8_t row, uint8_t col, bool pressed, uint8_t layer);
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+
+      // Writes results/latency.txt.  Called at the end of the simulation.
+      void finish(void);
+
+   private:
+
+      bool _started;
+      HID_KeyboardReport_Data_t _hostKeys;  // as of the last report
+};
+
+extern SIMULATION_LOCAL KeyLatencyReportConsumer KeyLatency;
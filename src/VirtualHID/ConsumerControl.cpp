@@ -1,6 +1,4 @@
-#include "ConsumerControl.h"
-#include <iostream>
-#include "virtual_io.h"
+#include "HIDReportConsumer.h"
 
 ConsumerControl_::ConsumerControl_(void) {}
 void ConsumerControl_::begin(void) { releaseAll(); }
@@ -37,8 +35,7 @@ void ConsumerControl_::release(uint16_t m) {
 }
 
 void ConsumerControl_::sendReport(void* data, int length) {
-  std::cout << "A virtual ConsumerControl HID report was sent." << std::endl;
-  logUSBEvent("ConsumerControl HID report", data, length);
+  HIDReports.processConsumerControlReport(*(const HID_ConsumerControlReport_Data_t*)data);
 }
 
-ConsumerControl_ ConsumerControl;
+SIMULATION_LOCAL ConsumerControl_ ConsumerControl;
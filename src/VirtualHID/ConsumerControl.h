@@ -4,6 +4,7 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include "Arduino.h"
+#include "simulation.h"
 #include "HIDTables.h"
 
 #define KEY_BYTES 28
@@ -33,4 +34,4 @@ class ConsumerControl_ {
     HID_ConsumerControlReport_Data_t _report;
 };
 
-extern ConsumerControl_ ConsumerControl;
+extern SIMULATION_LOCAL ConsumerControl_ ConsumerControl;
@@ -0,0 +1,181 @@
+#include <vector>
+#include "HIDReportConsumer.h"
+#include <iostream>
+#include <string>
+#include <signal.h>
+#include "virtual_io.h"
+#include "simulation.h"
+#include "usb_log.h"
+#include "snapshot.h"
+
+#define KEYBOARD_DESCRIP "Keyboard HID report; pressed keys: "
+
+// The text of the last keyboard report rendered, which both the stdout and the text log
+// consumers want; so each report is rendered at most once, however many ask for it.
+// The pressed keys start at sizeof(KEYBOARD_DESCRIP) - 1.
+static SIMULATION_LOCAL std::string renderedText;
+static SIMULATION_LOCAL HID_KeyboardReport_Data_t rendered;
+static SIMULATION_LOCAL bool renderedValid = false;
+static SnapshotCopy<std::string> renderedTextInSnapshots(renderedText);
+
+static const std::string &keyboardReportText(const HID_KeyboardReport_Data_t &reportData) {
+  if(renderedValid && !memcmp(rendered.allkeys, reportData.allkeys, sizeof(reportData))) return renderedText;
+  // Reused for every report, so only the first few allocate
+  renderedText = KEYBOARD_DESCRIP;
+  appendKeyboardReport(renderedText, reportData.allkeys, sizeof(reportData));
+  rendered = reportData;
+  renderedValid = true;
+  return renderedText;
+}
+
+void StdoutHIDReportConsumer::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  if(virtualVerbosity < VERBOSITY_REPORTS || isLazyReports()) return;
+  const std::string &descrip = keyboardReportText(reportData);
+  size_t keypresses = sizeof(KEYBOARD_DESCRIP) - 1;
+  std::cout << "Sent virtual HID report. Pressed keys: ";
+  std::cout.write(descrip.data() + keypresses, descrip.length() - keypresses) << std::endl;
+}
+
+void StdoutHIDReportConsumer::processMouseReport(const HID_MouseReport_Data_t &reportData) {
+  if(virtualVerbosity >= VERBOSITY_REPORTS && !isMouseTrajectory()) std::cout << "A virtual Mouse HID report was sent." << std::endl;
+}
+
+void StdoutHIDReportConsumer::processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) {
+  if(virtualVerbosity >= VERBOSITY_REPORTS) std::cout << "A virtual ConsumerControl HID report was sent." << std::endl;
+}
+
+void StdoutHIDReportConsumer::processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) {
+  if(virtualVerbosity >= VERBOSITY_REPORTS) std::cout << "A virtual SystemControl HID report with value " << reportData.key << " was sent." << std::endl;
+}
+
+void StdoutHIDReportConsumer::processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) {
+  if(virtualVerbosity >= VERBOSITY_REPORTS) std::cout << "A virtual SingleAbsoluteMouse HID report was sent." << std::endl;
+}
+
+// The log's names for each interface.  They are at file scope, so that they are
+// constructed before any simulation thread starts.
+static const std::string noDescrip;  // nothing to format unless it's logged as text
+static const std::string mouseDescrip("Mouse HID report");
+static const std::string consumerControlDescrip("ConsumerControl HID report");
+static const std::string systemControlDescrip("SystemControl HID report");
+static const std::string singleAbsoluteMouseDescrip("SingleAbsoluteMouse HID report");
+
+void USBLogHIDReportConsumer::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  logUSBEvent_keyboard(isTextUSBLog() ? keyboardReportText(reportData) : noDescrip,
+                       reportData.allkeys, sizeof(reportData));
+}
+
+void USBLogHIDReportConsumer::processMouseReport(const HID_MouseReport_Data_t &reportData) {
+  // Under --mouse-trajectory, the mouse is recorded in mouse_trajectory.txt instead
+  if(isMouseTrajectory()) return;
+  logUSBEvent(mouseDescrip, &reportData, sizeof(reportData));
+}
+
+void USBLogHIDReportConsumer::processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) {
+  logUSBEvent(consumerControlDescrip, &reportData, sizeof(reportData));
+}
+
+void USBLogHIDReportConsumer::processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) {
+  logUSBEvent(systemControlDescrip, &reportData, sizeof(reportData));
+}
+
+void USBLogHIDReportConsumer::processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) {
+  logUSBEvent(singleAbsoluteMouseDescrip, &reportData, sizeof(reportData));
+}
+
+// The deferred reports, stored by column
+static SIMULATION_LOCAL std::vector<uint32_t> deferredCycles;
+static SIMULATION_LOCAL std::vector<HID_KeyboardReport_Data_t> deferredReports;
+static SnapshotCopy<std::vector<uint32_t> > deferredCyclesInSnapshots(deferredCycles);
+static SnapshotCopy<std::vector<HID_KeyboardReport_Data_t> > deferredReportsInSnapshots(deferredReports);
+
+void LazyKeyboardReportConsumer::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  deferredCycles.push_back(currentCycle());
+  deferredReports.push_back(reportData);
+}
+
+void LazyKeyboardReportConsumer::render(void) {
+  if(deferredCycles.empty()) return;
+  bool print = virtualVerbosity >= VERBOSITY_REPORTS;
+  if(print) std::cout << "Keyboard reports, deferred by --lazy-reports:" << std::endl;
+  std::string descrip;
+  for(size_t i = 0; i < deferredCycles.size(); i++) {
+    descrip = KEYBOARD_DESCRIP;
+    size_t keypresses = descrip.length();
+    appendKeyboardReport(descrip, deferredReports[i].allkeys, sizeof(deferredReports[i]));
+    if(print) {
+      std::cout << "Cycle " << deferredCycles[i] << ": Sent virtual HID report. Pressed keys: ";
+      std::cout.write(descrip.data() + keypresses, descrip.length() - keypresses) << '\n';
+    }
+    logDeferredUSBEvent_keyboard(deferredCycles[i], descrip);
+  }
+  std::cout.flush();
+  flushUSBLog();
+  deferredCycles.clear();
+  deferredReports.clear();
+}
+
+// A failed assert() aborts, and that is just when the reports are wanted
+static void (*previousAbortHandler)(int) = SIG_DFL;
+static void renderReportsOnAbort(int sig) {
+  LazyKeyboardReports.render();
+  signal(sig, previousAbortHandler);
+  raise(sig);
+}
+
+static void renderLazyReports(void) { LazyKeyboardReports.render(); }
+static AtSimulationEnd renderAtEnd(renderLazyReports);
+
+HIDReportFanOut::HIDReportFanOut(void)
+  :  _consumerCount(0)
+{
+  addConsumer(StdoutHIDReports);
+  addConsumer(USBLogHIDReports);
+}
+
+bool HIDReportFanOut::addConsumer(HIDReportConsumer_ &consumer) {
+  for(uint8_t i = 0; i < _consumerCount; i++) {
+    if(_consumers[i] == &consumer) return true;
+  }
+  if(_consumerCount == MAX_HID_REPORT_CONSUMERS) return false;
+  _consumers[_consumerCount++] = &consumer;
+  // Lazy keyboard reports are rendered at the end, or on abort
+  if(&consumer == &LazyKeyboardReports) {
+    previousAbortHandler = signal(SIGABRT, renderReportsOnAbort);
+    if(previousAbortHandler == SIG_ERR) previousAbortHandler = SIG_DFL;
+  }
+  return true;
+}
+
+void HIDReportFanOut::removeConsumer(HIDReportConsumer_ &consumer) {
+  for(uint8_t i = 0; i < _consumerCount; i++) {
+    if(_consumers[i] != &consumer) continue;
+    for(_consumerCount--; i < _consumerCount; i++) _consumers[i] = _consumers[i + 1];
+    return;
+  }
+}
+
+void HIDReportFanOut::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  for(uint8_t i = 0; i < _consumerCount; i++) _consumers[i]->processKeyboardReport(reportData);
+}
+
+void HIDReportFanOut::processMouseReport(const HID_MouseReport_Data_t &reportData) {
+  for(uint8_t i = 0; i < _consumerCount; i++) _consumers[i]->processMouseReport(reportData);
+}
+
+void HIDReportFanOut::processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) {
+  for(uint8_t i = 0; i < _consumerCount; i++) _consumers[i]->processConsumerControlReport(reportData);
+}
+
+void HIDReportFanOut::processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) {
+  for(uint8_t i = 0; i < _consumerCount; i++) _consumers[i]->processSystemControlReport(reportData);
+}
+
+void HIDReportFanOut::processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) {
+  for(uint8_t i = 0; i < _consumerCount; i++) _consumers[i]->processSingleAbsoluteMouseReport(reportData);
+}
+
+SIMULATION_LOCAL StdoutHIDReportConsumer StdoutHIDReports;
+SIMULATION_LOCAL USBLogHIDReportConsumer USBLogHIDReports;
+SIMULATION_LOCAL LazyKeyboardReportConsumer LazyKeyboardReports;
+SIMULATION_LOCAL HIDReportFanOut HIDReports;
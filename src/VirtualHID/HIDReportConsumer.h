@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Keyboard.h"
+#include "ConsumerControl.h"
+#include "SystemControl.h"
+#include "Mouse.h"
+#include "SingleAbsoluteMouse.h"
+
+// A consumer of the reports sent by every virtual HID interface.  Each report is passed by
+// const reference to the interface's own report data, so consumers never copy or format
+// anything they don't need.  Every method does nothing unless overridden, so a consumer
+// only implements the interfaces it is interested in.
+class HIDReportConsumer_
+{
+   public:
+
+      virtual ~HIDReportConsumer_() {}
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {}
+      virtual void processMouseReport(const HID_MouseReport_Data_t &reportData) {}
+      virtual void processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) {}
+      virtual void processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) {}
+      virtual void processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) {}
+};
+
+// Prints a line on stdout for each report (at --verbosity=1 and above).  Keyboard reports
+// are left to LazyKeyboardReportConsumer under --lazy-reports, and mouse reports to
+// MouseTrajectoryReportConsumer under --mouse-trajectory.
+class StdoutHIDReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+      virtual void processMouseReport(const HID_MouseReport_Data_t &reportData) override;
+      virtual void processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) override;
+      virtual void processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) override;
+      virtual void processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) override;
+};
+
+// Writes each report to the USB log in "results" (text or binary, as chosen by --usb-log),
+// and to the --verify-sparse-scan comparison; except mouse reports under --mouse-trajectory
+class USBLogHIDReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+      virtual void processMouseReport(const HID_MouseReport_Data_t &reportData) override;
+      virtual void processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) override;
+      virtual void processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) override;
+      virtual void processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) override;
+};
+
+// Keeps each keyboard report raw, with the cycle it was sent in, and only renders them (as
+// they would have been printed and logged) in render().  This is the consumer for
+// --lazy-reports, where render() is called at the end of the simulation, or on abort.
+class LazyKeyboardReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+      void render(void);
+};
+
+#define MAX_HID_REPORT_CONSUMERS 8
+
+// Passes every report from every interface on to each of its consumers, in the order they
+// were added.  It starts out with StdoutHIDReports and USBLogHIDReports; anything else
+// that wants the reports (assertions, metrics, a trace of its own) adds itself, and a
+// harness that only wants some of the output can remove the others.  It is also the
+// keyboard's default KeyboardReportConsumer_.
+class HIDReportFanOut : public KeyboardReportConsumer_
+{
+   public:
+
+      HIDReportFanOut(void);
+
+      // Returns FALSE if there is no room for another consumer.  Adding a consumer that is
+      // already there does nothing.
+      bool addConsumer(HIDReportConsumer_ &consumer);
+      void removeConsumer(HIDReportConsumer_ &consumer);
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+      void processMouseReport(const HID_MouseReport_Data_t &reportData);
+      void processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData);
+      void processSystemControlReport(const HID_SystemControlReport_Data_t &reportData);
+      void processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData);
+
+   private:
+
+      HIDReportConsumer_ *_consumers[MAX_HID_REPORT_CONSUMERS];
+      uint8_t _consumerCount;
+};
+
+extern SIMULATION_LOCAL StdoutHIDReportConsumer StdoutHIDReports;
+extern SIMULATION_LOCAL USBLogHIDReportConsumer USBLogHIDReports;
+extern SIMULATION_LOCAL LazyKeyboardReportConsumer LazyKeyboardReports;
+extern SIMULATION_LOCAL HIDReportFanOut HIDReports;
@@ -1,18 +1,19 @@
-#include "Keyboard.h"
-#include <iostream>
-#include <sstream>
+#include "HIDReportConsumer.h"
+#include "USBHostModel.h"
+#include <string>
 #include "virtual_io.h"
+#include "usb_log.h"
 #include <assert.h>
 
-static StandardKeyboardReportConsumer standardKeyboardReportConsumer;
-
 Keyboard_::Keyboard_(void) 
-  :  _keyboardReportConsumer(&standardKeyboardReportConsumer)
+  :  _keyboardReportConsumer(&HIDReports)
 {
 }
 
 void Keyboard_::begin(void) {
   releaseAll();
+  if(isLazyReports()) HIDReports.addConsumer(LazyKeyboardReports);
+  if(hostPollMicros()) HIDReports.addConsumer(USBHostModel);
 }
 void Keyboard_::end(void) {
   releaseAll();
@@ -79,17 +80,6 @@ boolean Keyboard_::wasModifierActive(uint8_t k) {
 // TODO: Emulate this in a reasonable way rather than always returning 0
 uint8_t Keyboard_::getLEDs() { return 0; }
 
-// For each bit set in 'bitfield', output the corresponding string to 'stream'
-#define FOREACHBIT(bitfield, stream, str0, str1, str2, str3, str4, str5, str6, str7) \
-  if((bitfield) & 1<<0) stream << str0; \
-  if((bitfield) & 1<<1) stream << str1; \
-  if((bitfield) & 1<<2) stream << str2; \
-  if((bitfield) & 1<<3) stream << str3; \
-  if((bitfield) & 1<<4) stream << str4; \
-  if((bitfield) & 1<<5) stream << str5; \
-  if((bitfield) & 1<<6) stream << str6; \
-  if((bitfield) & 1<<7) stream << str7;
-
 int Keyboard_::sendReport(void) {
   // Following KeyboardioHID, we only send report if it differs from previous report.
   if(!memcmp(_lastKeyReport.allkeys, _keyReport.allkeys, sizeof(_keyReport))) return -1;
@@ -109,69 +99,133 @@ void Keyboard_::setKeyboardReportConsumer(
    _keyboardReportConsumer = &keyboardReportConsumer;
 }
 
-void StandardKeyboardReportConsumer::processKeyboardReport(
-                                 const HID_KeyboardReport_Data_t &reportData)
-{
-  std::stringstream keypresses;
-  bool anything = false;
-  if(reportData.modifiers) anything = true;
-  else for(int i = 0; i < KEY_BYTES; i++) if(reportData.keys[i]) { anything = true; break; }
-  if(!anything) {
-    keypresses << "none";
-  } else {
-    FOREACHBIT(reportData.modifiers, keypresses,
-        "lctrl ", "lshift ", "lalt ", "lgui ",
-        "rctrl ", "rshift ", "ralt ", "rgui ")
-    FOREACHBIT(reportData.keys[0], keypresses,
-        "NO_EVENT ", "ERROR_ROLLOVER ", "POST_FAIL ", "ERROR_UNDEFINED ",
-        "a ", "b ", "c ", "d ")
-    FOREACHBIT(reportData.keys[1], keypresses,
-        "e ", "f ", "g ", "h ", "i ", "j ", "k ", "l ")
-    FOREACHBIT(reportData.keys[2], keypresses,
-        "m ", "n ", "o ", "p ", "q ", "r ", "s ", "t ")
-    FOREACHBIT(reportData.keys[3], keypresses,
-        "u ", "v ", "w ", "x ", "y ", "z ", "1/! ", "2/@ ")
-    FOREACHBIT(reportData.keys[4], keypresses,
-        "3/# ", "4/$ ", "5/% ", "6/^ ", "7/& ", "8/* ", "9/( ", "0/) ")
-    FOREACHBIT(reportData.keys[5], keypresses,
-        "enter ", "esc ", "del/bksp ", "tab ",
-        "space ", "-/_ ", "=/+ ", "[/{ ")
-    FOREACHBIT(reportData.keys[6], keypresses,
-        "]/} ", "\\/| ", "#/~ ", ";/: ", "'/\" ", "`/~ ", ",/< ", "./> ")
-    FOREACHBIT(reportData.keys[7], keypresses,
-        "//? ", "capslock ", "F1 ", "F2 ", "F3 ", "F4 ", "F5 ", "F6 ")
-    FOREACHBIT(reportData.keys[8], keypresses,
-        "F7 ", "F8 ", "F9 ", "F10 ", "F11 ", "F12 ", "prtscr ", "scrolllock ")
-    FOREACHBIT(reportData.keys[9], keypresses,
-        "pause ", "ins ", "home ", "pgup ", "del ", "end ", "pgdn ", "r_arrow ")
-    FOREACHBIT(reportData.keys[10], keypresses,
-        "l_arrow ", "d_arrow ", "u_arrow ", "numlock ",
-        "num/ ", "num* ", "num- ", "num+ ")
-    FOREACHBIT(reportData.keys[11], keypresses,
-        "numenter ", "num1 ", "num2 ", "num3 ",
-        "num4 ", "num5 ", "num6 ", "num7 ")
-    FOREACHBIT(reportData.keys[12], keypresses,
-        "num8 ", "num9 ", "num0 ", "num. ", "\\/| ", "app ", "power ", "num= ")
-    FOREACHBIT(reportData.keys[13], keypresses,
-        "F13 ", "F14 ", "F15 ", "F16 ", "F17 ", "F18 ", "F19 ", "F20 ")
-    FOREACHBIT(reportData.keys[14], keypresses,
-        "F21 ", "F22 ", "F23 ", "F24 ", "exec ", "help ", "menu ", "sel ")
-    FOREACHBIT(reportData.keys[15], keypresses,
-        "stop ", "again ", "undo ", "cut ", "copy ", "paste ", "find ", "mute ")
-    FOREACHBIT(reportData.keys[16], keypresses,
-        "volup ", "voldn ", "capslock_l ", "numlock_l ",
-        "scrolllock_l ", "num, ", "num= ", "(other) ")
-    for(int i = 17; i < KEY_BYTES; i++) {
-      // A little imprecise, in two ways:
-      //   (1) obviously, "(other)" refers to many distinct keys
-      //   (2) this might undercount the number of "other" keys pressed
-      // Therefore, if any keys are frequently used, they should be handled above and not via "other"
-      if(reportData.keys[i]) keypresses << "(other) ";
+typedef struct {
+  const char* name;  // with a trailing space, ready to append
+  uint8_t length;
+} UsageName;
+
+#define USAGE(name) { name " ", sizeof(name) }
+
+// Names of the modifiers, by bit of the report's 'modifiers' byte (usages 0xE0-0xE7)
+static const UsageName modifierNames[8] = {
+  USAGE("lctrl"), USAGE("lshift"), USAGE("lalt"), USAGE("lgui"),
+  USAGE("rctrl"), USAGE("rshift"), USAGE("ralt"), USAGE("rgui"),
+};
+
+// Names of the keys, by usage (Keyboard/Keypad page of the HID Usage Tables, as in
+// HIDTables.h), which is also the key's bit in the report's 'keys' bitmap
+static const UsageName keyNames[KEY_BYTES * 8] = {
+  // 0x00
+  USAGE("NO_EVENT"), USAGE("ERROR_ROLLOVER"), USAGE("POST_FAIL"), USAGE("ERROR_UNDEFINED"),
+  USAGE("a"), USAGE("b"), USAGE("c"), USAGE("d"),
+  USAGE("e"), USAGE("f"), USAGE("g"), USAGE("h"), USAGE("i"), USAGE("j"), USAGE("k"), USAGE("l"),
+  // 0x10
+  USAGE("m"), USAGE("n"), USAGE("o"), USAGE("p"), USAGE("q"), USAGE("r"), USAGE("s"), USAGE("t"),
+  USAGE("u"), USAGE("v"), USAGE("w"), USAGE("x"), USAGE("y"), USAGE("z"), USAGE("1/!"), USAGE("2/@"),
+  // 0x20
+  USAGE("3/#"), USAGE("4/$"), USAGE("5/%"), USAGE("6/^"), USAGE("7/&"), USAGE("8/*"), USAGE("9/("), USAGE("0/)"),
+  USAGE("enter"), USAGE("esc"), USAGE("del/bksp"), USAGE("tab"),
+  USAGE("space"), USAGE("-/_"), USAGE("=/+"), USAGE("[/{"),
+  // 0x30
+  USAGE("]/}"), USAGE("\\/|"), USAGE("#/~"), USAGE(";/:"), USAGE("'/\""), USAGE("`/~"), USAGE(",/<"), USAGE("./>"),
+  USAGE("//?"), USAGE("capslock"), USAGE("F1"), USAGE("F2"), USAGE("F3"), USAGE("F4"), USAGE("F5"), USAGE("F6"),
+  // 0x40
+  USAGE("F7"), USAGE("F8"), USAGE("F9"), USAGE("F10"), USAGE("F11"), USAGE("F12"), USAGE("prtscr"), USAGE("scrolllock"),
+  USAGE("pause"), USAGE("ins"), USAGE("home"), USAGE("pgup"), USAGE("del"), USAGE("end"), USAGE("pgdn"), USAGE("r_arrow"),
+  // 0x50
+  USAGE("l_arrow"), USAGE("d_arrow"), USAGE("u_arrow"), USAGE("numlock"),
+  USAGE("num/"), USAGE("num*"), USAGE("num-"), USAGE("num+"),
+  USAGE("numenter"), USAGE("num1"), USAGE("num2"), USAGE("num3"),
+  USAGE("num4"), USAGE("num5"), USAGE("num6"), USAGE("num7"),
+  // 0x60
+  USAGE("num8"), USAGE("num9"), USAGE("num0"), USAGE("num."), USAGE("\\/|"), USAGE("app"), USAGE("power"), USAGE("num="),
+  USAGE("F13"), USAGE("F14"), USAGE("F15"), USAGE("F16"), USAGE("F17"), USAGE("F18"), USAGE("F19"), USAGE("F20"),
+  // 0x70
+  USAGE("F21"), USAGE("F22"), USAGE("F23"), USAGE("F24"), USAGE("exec"), USAGE("help"), USAGE("menu"), USAGE("sel"),
+  USAGE("stop"), USAGE("again"), USAGE("undo"), USAGE("cut"), USAGE("copy"), USAGE("paste"), USAGE("find"), USAGE("mute"),
+  // 0x80
+  USAGE("volup"), USAGE("voldn"), USAGE("capslock_l"), USAGE("numlock_l"),
+  USAGE("scrolllock_l"), USAGE("num,"), USAGE("num="), USAGE("intl1"),
+  USAGE("intl2"), USAGE("intl3"), USAGE("intl4"), USAGE("intl5"),
+  USAGE("intl6"), USAGE("intl7"), USAGE("intl8"), USAGE("intl9"),
+  // 0x90
+  USAGE("lang1"), USAGE("lang2"), USAGE("lang3"), USAGE("lang4"),
+  USAGE("lang5"), USAGE("lang6"), USAGE("lang7"), USAGE("lang8"),
+  USAGE("lang9"), USAGE("alterase"), USAGE("sysreq"), USAGE("cancel"),
+  USAGE("clear"), USAGE("prior"), USAGE("return"), USAGE("separator"),
+  // 0xA0
+  USAGE("out"), USAGE("oper"), USAGE("clear/again"), USAGE("crsel/props"),
+  USAGE("exsel"), USAGE("(0xa5)"), USAGE("(0xa6)"), USAGE("(0xa7)"),
+  USAGE("(0xa8)"), USAGE("(0xa9)"), USAGE("(0xaa)"), USAGE("(0xab)"),
+  USAGE("(0xac)"), USAGE("(0xad)"), USAGE("(0xae)"), USAGE("(0xaf)"),
+  // 0xB0
+  USAGE("num00"), USAGE("num000"), USAGE("thousands_sep"), USAGE("decimal_sep"),
+  USAGE("currency"), USAGE("currency_sub"), USAGE("num("), USAGE("num)"),
+  USAGE("num{"), USAGE("num}"), USAGE("numtab"), USAGE("numbksp"),
+  USAGE("numA"), USAGE("numB"), USAGE("numC"), USAGE("numD"),
+  // 0xC0
+  USAGE("numE"), USAGE("numF"), USAGE("numxor"), USAGE("num^"),
+  USAGE("num%"), USAGE("num<"), USAGE("num>"), USAGE("num&"),
+  USAGE("num&&"), USAGE("num|"), USAGE("num||"), USAGE("num:"),
+  USAGE("num#"), USAGE("numspace"), USAGE("num@"), USAGE("num!"),
+  // 0xD0
+  USAGE("memstore"), USAGE("memrecall"), USAGE("memclear"), USAGE("mem+"),
+  USAGE("mem-"), USAGE("mem*"), USAGE("mem/"), USAGE("num+/-"),
+  USAGE("numclear"), USAGE("numclearentry"), USAGE("numbin"), USAGE("numoct"),
+  USAGE("numdec"), USAGE("numhex"), USAGE("(0xde)"), USAGE("(0xdf)"),
+};
+
+#undef USAGE
+
+static bool nameIs(const UsageName &usage, const char* name, size_t length) {
+  return usage.length == length + 1 && memcmp(usage.name, name, length) == 0;
+}
+
+bool setKeyByName(HID_KeyboardReport_Data_t &report, const char* name, size_t length) {
+  for(unsigned i = 0; i < 8; i++) {
+    if(nameIs(modifierNames[i], name, length)) {
+      report.modifiers |= 1 << i;
+      return true;
     }
   }
+  for(unsigned i = 0; i < KEY_BYTES * 8; i++) {
+    if(nameIs(keyNames[i], name, length)) {
+      report.keys[i / 8] |= 1 << (i % 8);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends the name of each set bit of 'bits' to 'out', lowest bit first
+static void appendNames(std::string &out, uint64_t bits, const UsageName* names) {
+  while(bits) {
+    const UsageName &usage = names[__builtin_ctzll(bits)];
+    out.append(usage.name, usage.length);
+    bits &= bits - 1;
+  }
+}
+
+void appendKeyboardReport(std::string &out, const void* data, size_t length) {
+  // The bitmap is walked 64 bits at a time, so only its set bits cost anything
+  uint64_t words[(KEY_BYTES + 7) / 8] = {0};
+  uint8_t modifiers = 0;
+  if(length > 0) modifiers = ((const uint8_t*)data)[0];
+  if(length > 1) memcpy(words, (const uint8_t*)data + 1, length - 1 < KEY_BYTES ? length - 1 : KEY_BYTES);
+
+  size_t start = out.length();
+  appendNames(out, modifiers, modifierNames);
+  for(unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    appendNames(out, words[i], keyNames + 64*i);
+  }
+  if(out.length() == start) out += "none";
+}
 
-  std::cout << "Sent virtual HID report. Pressed keys: " << keypresses.str() << std::endl;
-  logUSBEvent_keyboard("Keyboard HID report; pressed keys: " + keypresses.str());
+void StandardKeyboardReportConsumer::processKeyboardReport(
+                                 const HID_KeyboardReport_Data_t &reportData)
+{
+  StdoutHIDReports.processKeyboardReport(reportData);
+  USBLogHIDReports.processKeyboardReport(reportData);
 }
 
-Keyboard_ Keyboard;
+SIMULATION_LOCAL Keyboard_ Keyboard;
@@ -4,6 +4,7 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include "Arduino.h"
+#include "simulation.h"
 #include "HIDTables.h"
 #define HID_FIRST_KEY HID_KEYBOARD_NO_EVENT
 #define HID_LAST_KEY HID_KEYPAD_HEXADECIMAL
@@ -30,6 +31,8 @@ class KeyboardReportConsumer_
                      const HID_KeyboardReport_Data_t &reportData) = 0;
 };
 
+// Prints and logs each report, as the keyboard did before HIDReportFanOut (HIDReportConsumer.h),
+// which is now the keyboard's default consumer
 class StandardKeyboardReportConsumer : public KeyboardReportConsumer_
 {
    public:
@@ -38,6 +41,10 @@ class StandardKeyboardReportConsumer : public KeyboardReportConsumer_
                      const HID_KeyboardReport_Data_t &reportData) override;
 };
 
+// Sets the bit of the key or modifier called 'name' (as it is printed in reports, e.g. "lshift"
+// or "1/!") in 'report'.  Returns FALSE if there is no such key.
+bool setKeyByName(HID_KeyboardReport_Data_t &report, const char* name, size_t length);
+
 class Keyboard_ {
   public:
     Keyboard_(void);
@@ -54,6 +61,8 @@ class Keyboard_ {
     
     void setKeyboardReportConsumer(
             KeyboardReportConsumer_ &keyboardReportConsumer);
+    KeyboardReportConsumer_ &getKeyboardReportConsumer(void) { return *_keyboardReportConsumer; }
+    const HID_KeyboardReport_Data_t &getLastKeyReport(void) const { return _lastKeyReport; }
 
   protected:
     HID_KeyboardReport_Data_t _keyReport;
@@ -62,4 +71,4 @@ class Keyboard_ {
     KeyboardReportConsumer_ *_keyboardReportConsumer;
 };
 
-extern Keyboard_ Keyboard;
+extern SIMULATION_LOCAL Keyboard_ Keyboard;
@@ -0,0 +1,111 @@
+#include <vector>
+#include "KeyboardExpectations.h"
+#include <iostream>
+#include <string>
+#include "virtual_io.h"
+#include "simulation.h"
+#include "usb_log.h"
+#include "snapshot.h"
+
+#define HISTORY_LENGTH 8  // reports shown when an expectation fails
+
+typedef struct {
+  HID_KeyboardReport_Data_t keys;
+  unsigned setCycle;  // the cycle of the EXPECT
+  unsigned lastCycle;  // the last cycle in which it can be met
+  bool early;  // TRUE if a report during those cycles can meet it, not just the state at the end
+} Expectation;
+
+static SIMULATION_LOCAL std::vector<Expectation> expectations;
+static SnapshotCopy<std::vector<Expectation> > expectationsInSnapshots(expectations);
+
+// The last few reports, for context when an expectation fails
+static SIMULATION_LOCAL HID_KeyboardReport_Data_t history[HISTORY_LENGTH];
+static SIMULATION_LOCAL unsigned historyCycles[HISTORY_LENGTH];
+static SIMULATION_LOCAL unsigned historyCount = 0;
+
+static bool sameKeys(const HID_KeyboardReport_Data_t &a, const HID_KeyboardReport_Data_t &b) {
+  return memcmp(a.allkeys, b.allkeys, sizeof(a.allkeys)) == 0;
+}
+
+static std::string keysText(const HID_KeyboardReport_Data_t &keys) {
+  std::string text;
+  appendKeyboardReport(text, keys.allkeys, sizeof(keys.allkeys));
+  return text;
+}
+
+static void checkAtEndOfScript(void) {
+  KeyboardExpectations.checkDeadlines(true);
+}
+
+ExpectingKeyboardReportConsumer::ExpectingKeyboardReportConsumer(void)
+  :  _started(false)
+{
+  memset(_hostKeys.allkeys, 0, sizeof(_hostKeys.allkeys));
+}
+
+void ExpectingKeyboardReportConsumer::processKeyboardReport(
+                                 const HID_KeyboardReport_Data_t &reportData)
+{
+  _hostKeys = reportData;
+  history[historyCount % HISTORY_LENGTH] = reportData;
+  historyCycles[historyCount % HISTORY_LENGTH] = currentCycle();
+  historyCount++;
+  for(size_t i = 0; i < expectations.size(); ) {
+    if(expectations[i].early && sameKeys(expectations[i].keys, reportData)) {
+      expectations.erase(expectations.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void ExpectingKeyboardReportConsumer::expect(const HID_KeyboardReport_Data_t &keys, unsigned withinCycles) {
+  // Reports reach this consumer from the first EXPECT on
+  if(!_started) {
+    _started = true;
+    _hostKeys = Keyboard.getLastKeyReport();
+    HIDReports.addConsumer(*this);
+    setEndOfScriptHook(checkAtEndOfScript);
+  }
+  if(withinCycles && sameKeys(keys, _hostKeys)) return;  // already met
+  Expectation expectation;
+  expectation.keys = keys;
+  expectation.setCycle = currentCycle();
+  expectation.lastCycle = currentCycle() + withinCycles;
+  expectation.early = withinCycles > 0;
+  expectations.push_back(expectation);
+}
+
+void ExpectingKeyboardReportConsumer::checkDeadlines(bool endOfScript) {
+  for(size_t i = 0; i < expectations.size(); ) {
+    if(!endOfScript && expectations[i].lastCycle >= currentCycle()) {
+      i++;
+    } else if(sameKeys(expectations[i].keys, _hostKeys)) {
+      expectations.erase(expectations.begin() + i);
+    } else {
+      fail(i);
+    }
+  }
+}
+
+void ExpectingKeyboardReportConsumer::fail(unsigned index) {
+  const Expectation &expectation = expectations[index];
+  std::cout.flush();
+  std::cerr << "EXPECT failed: expected keys: " << keysText(expectation.keys) << std::endl;
+  std::cerr << "  expected in cycle " << expectation.setCycle;
+  if(expectation.lastCycle != expectation.setCycle) std::cerr << ", within " << expectation.lastCycle - expectation.setCycle << " cycles";
+  std::cerr << "; now at cycle " << currentCycle() << std::endl;
+  std::cerr << "  host has keys: " << keysText(_hostKeys) << std::endl;
+  if(historyCount) {
+    std::cerr << "  last reports:" << std::endl;
+    unsigned first = historyCount > HISTORY_LENGTH ? historyCount - HISTORY_LENGTH : 0;
+    for(unsigned i = first; i < historyCount; i++) {
+      std::cerr << "    cycle " << historyCycles[i % HISTORY_LENGTH] << ": "
+        << keysText(history[i % HISTORY_LENGTH]) << std::endl;
+    }
+  }
+  endSimulation(1);
+}
+
+SIMULATION_LOCAL ExpectingKeyboardReportConsumer KeyboardExpectations;
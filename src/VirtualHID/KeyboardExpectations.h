@@ -0,0 +1,34 @@
+#pragma once
+
+#include "HIDReportConsumer.h"
+
+// Checks the keyboard reports against a script's EXPECT directives as they are sent.  The
+// first expectation that isn't met ends the program with exit status 1, after printing the
+// reports leading up to it.
+class ExpectingKeyboardReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      ExpectingKeyboardReportConsumer(void);
+
+      virtual void processKeyboardReport(
+                     const HID_KeyboardReport_Data_t &reportData) override;
+
+      // The host must see exactly 'keys' pressed by the end of this cycle, or with
+      // 'withinCycles', at some point by the end of the withinCycles'th cycle after this one
+      void expect(const HID_KeyboardReport_Data_t &keys, unsigned withinCycles);
+
+      // Fails any expectation whose last cycle has passed without it being met.  This is
+      // called at the start of each cycle, and at the end of the script, where every
+      // expectation still waiting is checked.
+      void checkDeadlines(bool endOfScript = false);
+
+   private:
+
+      bool _started;
+      HID_KeyboardReport_Data_t _hostKeys;  // as of the last report
+
+      void fail(unsigned index);
+};
+
+extern SIMULATION_LOCAL ExpectingKeyboardReportConsumer KeyboardExpectations;
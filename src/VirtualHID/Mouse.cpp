@@ -1,9 +1,14 @@
-#include "Mouse.h"
-#include <iostream>
+#include "HIDReportConsumer.h"
+#include "MouseTrajectory.h"
 #include "virtual_io.h"
 
-Mouse_::Mouse_(void) {}
-void Mouse_::begin(void) { releaseAll(); }
+Mouse_::Mouse_(void) {
+  memset(&_lastReport, 0, sizeof(_lastReport));
+}
+void Mouse_::begin(void) {
+  if(isMouseTrajectory()) HIDReports.addConsumer(MouseTrajectory);
+  releaseAll();
+}
 void Mouse_::end(void) { releaseAll(); }
 void Mouse_::releaseAll(void) {
   _buttons = 0;
@@ -46,8 +51,13 @@ bool Mouse_::isPressed(uint8_t b) {
 }
 
 void Mouse_::sendReport(void* data, int length) {
-  std::cout << "A virtual Mouse HID report was sent." << std::endl;
-  logUSBEvent("Mouse HID report", data, length);
+  const HID_MouseReport_Data_t &report = *(const HID_MouseReport_Data_t*)data;
+  // A report with no movement that repeats the last one tells the host nothing, so (as on
+  // real hardware) it isn't sent.  Repeated movement is still movement, and is always sent.
+  if(!report.xAxis && !report.yAxis && !report.wheel
+     && !memcmp(&report, &_lastReport, sizeof(report))) return;
+  _lastReport = report;
+  HIDReports.processMouseReport(report);
 }
 
-Mouse_ Mouse;
+SIMULATION_LOCAL Mouse_ Mouse;
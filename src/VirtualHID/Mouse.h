@@ -4,6 +4,7 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include <Arduino.h>
+#include "simulation.h"
 
 #define MOUSE_LEFT    (1 << 0)
 #define MOUSE_RIGHT   (1 << 1)
@@ -37,8 +38,9 @@ class Mouse_ {
 
  protected:
   uint8_t _buttons;
+  HID_MouseReport_Data_t _lastReport;
   void buttons(uint8_t b);
   void releaseAll(void);
 };
 
-extern Mouse_ Mouse;
+extern SIMULATION_LOCAL Mouse_ Mouse;
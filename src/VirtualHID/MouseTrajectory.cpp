@@ -0,0 +1,47 @@
+#include "MouseTrajectory.h"
+#include "virtual_io.h"
+#include "simulation.h"
+#include "virtual_clock.h"
+#include <stdio.h>
+
+MouseTrajectoryReportConsumer::MouseTrajectoryReportConsumer(void)
+  :  _out(NULL), _millis(0), _reports(0), _x(0), _y(0), _wheel(0), _buttons(0)
+{
+}
+
+void MouseTrajectoryReportConsumer::processMouseReport(const HID_MouseReport_Data_t &reportData) {
+  if(!_out) {
+    _out = openResultsFile("mouse_trajectory.txt");
+    if(!_out) {
+      fprintf(stderr, "Error opening results/mouse_trajectory.txt\n");
+      HIDReports.removeConsumer(*this);
+      return;
+    }
+    fprintf(_out, "# ms x y wheel buttons reports\n");
+  }
+  uint64_t millis = virtualMicros() / 1000;
+  if(millis != _millis) writeMillisecond();
+  _millis = millis;
+  _reports++;
+  _x += reportData.xAxis;
+  _y += reportData.yAxis;
+  _wheel += reportData.wheel;
+  _buttons = reportData.buttons;
+}
+
+void MouseTrajectoryReportConsumer::writeMillisecond(void) {
+  if(!_reports) return;
+  fprintf(_out, "%llu %ld %ld %ld 0x%02x %u\n", (unsigned long long)_millis, _x, _y, _wheel, _buttons, _reports);
+  _reports = 0;
+}
+
+void MouseTrajectoryReportConsumer::finish(void) {
+  if(!_out) return;
+  writeMillisecond();
+  fflush(_out);
+}
+
+SIMULATION_LOCAL MouseTrajectoryReportConsumer MouseTrajectory;
+
+static void finishMouseTrajectory(void) { MouseTrajectory.finish(); }
+static AtSimulationEnd mouseTrajectoryAtEnd(finishMouseTrajectory);
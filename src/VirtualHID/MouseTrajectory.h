@@ -0,0 +1,33 @@
+#pragma once
+
+#include "HIDReportConsumer.h"
+
+// The mouse trajectory recorder (--mouse-trajectory).  It integrates the mouse reports'
+// movement into a cursor position and wheel position, and writes one line to
+// results/mouse_trajectory.txt for each virtual millisecond in which any mouse report was
+// sent: the millisecond, the position as of its end, the buttons held, and the number of
+// reports sent in it.  Milliseconds with no reports are left out.  The mouse reports are
+// then neither printed nor written to the USB log.
+class MouseTrajectoryReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      MouseTrajectoryReportConsumer(void);
+
+      virtual void processMouseReport(const HID_MouseReport_Data_t &reportData) override;
+
+      // Writes out the last millisecond.  Called at the end of the simulation.
+      void finish(void);
+
+   private:
+
+      FILE* _out;
+      uint64_t _millis;  // the millisecond being recorded
+      unsigned _reports;  // sent in it so far; 0 if nothing is being recorded
+      long _x, _y, _wheel;
+      uint8_t _buttons;
+
+      void writeMillisecond(void);
+};
+
+extern SIMULATION_LOCAL MouseTrajectoryReportConsumer MouseTrajectory;
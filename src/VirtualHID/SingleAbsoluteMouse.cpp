@@ -1,12 +1,9 @@
-#include "SingleAbsoluteMouse.h"
-#include <iostream>
-#include "virtual_io.h"
+#include "HIDReportConsumer.h"
 
 SingleAbsoluteMouse_::SingleAbsoluteMouse_(void) {}
 
 void SingleAbsoluteMouse_::sendReport(void* data, int length) {
-  std::cout << "A virtual SingleAbsoluteMouse HID report was sent." << std::endl;
-  logUSBEvent("SingleAbsoluteMouse HID report", data, length);
+  HIDReports.processSingleAbsoluteMouseReport(*(const HID_MouseAbsoluteReport_Data_t*)data);
 }
 
 // Everything else is stubs for now - no effect
@@ -17,4 +14,4 @@ void SingleAbsoluteMouse_::click(uint8_t buttons) {}
 void SingleAbsoluteMouse_::press(uint8_t buttons) {}
 void SingleAbsoluteMouse_::release(uint8_t buttons) {}
 
-SingleAbsoluteMouse_ SingleAbsoluteMouse;
+SIMULATION_LOCAL SingleAbsoluteMouse_ SingleAbsoluteMouse;
@@ -4,6 +4,18 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include <Arduino.h>
+#include "simulation.h"
+
+typedef union {
+  // Absolute mouse report: 8 buttons, 2 absolute axis, wheel
+  struct {
+    uint8_t buttons;
+    uint16_t xAxis;
+    uint16_t yAxis;
+    int8_t wheel;
+  } __attribute__((packed));
+  uint8_t whole8[6];
+} HID_MouseAbsoluteReport_Data_t;
 
 class SingleAbsoluteMouse_ {
 public:
@@ -18,6 +30,6 @@ public:
     void sendReport(void* data, int length);
 };
 
-extern SingleAbsoluteMouse_ SingleAbsoluteMouse;
+extern SIMULATION_LOCAL SingleAbsoluteMouse_ SingleAbsoluteMouse;
 
 
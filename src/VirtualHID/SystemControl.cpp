@@ -1,6 +1,4 @@
-#include "SystemControl.h"
-#include <iostream>
-#include "virtual_io.h"
+#include "HIDReportConsumer.h"
 
 SystemControl_::SystemControl_(void) {}
 void SystemControl_::begin(void) { releaseAll(); }
@@ -22,8 +20,7 @@ void SystemControl_::press(uint8_t s) {
 }
 
 void SystemControl_::sendReport(void* data, int length) {
-  std::cout << "A virtual SystemControl HID report with value " << *(uint8_t*)data << " was sent." << std::endl;
-  logUSBEvent("SystemControl HID report", data, length);
+  HIDReports.processSystemControlReport(*(const HID_SystemControlReport_Data_t*)data);
 }
 
-SystemControl_ SystemControl;
+SIMULATION_LOCAL SystemControl_ SystemControl;
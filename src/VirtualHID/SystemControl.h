@@ -4,6 +4,7 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include <Arduino.h>
+#include "simulation.h"
 #include "HIDTables.h"
 
 typedef union {
@@ -24,5 +25,5 @@ class SystemControl_ {
   void sendReport(void* data, int length);
 };
 
-extern SystemControl_ SystemControl;
+extern SIMULATION_LOCAL SystemControl_ SystemControl;
 
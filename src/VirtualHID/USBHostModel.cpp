@@ -0,0 +1,146 @@
+#include "USBHostModel.h"
+#include <iostream>
+#include "virtual_clock.h"
+#include "simulation.h"
+
+USBHostReportConsumer::USBHostReportConsumer(void)
+  :  _nextPoll(0)
+{
+  memset(_endpoints, 0, sizeof(_endpoints));
+  _endpoints[KEYBOARD].name = "Keyboard";
+  _endpoints[MOUSE].name = "Mouse";
+  _endpoints[MOUSE].relative = true;
+  _endpoints[CONSUMER_CONTROL].name = "ConsumerControl";
+  _endpoints[SYSTEM_CONTROL].name = "SystemControl";
+  _endpoints[SINGLE_ABSOLUTE_MOUSE].name = "SingleAbsoluteMouse";
+}
+
+void USBHostReportConsumer::processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) {
+  send(_endpoints[KEYBOARD], &reportData, sizeof(reportData));
+}
+
+void USBHostReportConsumer::processMouseReport(const HID_MouseReport_Data_t &reportData) {
+  send(_endpoints[MOUSE], &reportData, sizeof(reportData));
+}
+
+void USBHostReportConsumer::processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) {
+  send(_endpoints[CONSUMER_CONTROL], &reportData, sizeof(reportData));
+}
+
+void USBHostReportConsumer::processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) {
+  send(_endpoints[SYSTEM_CONTROL], &reportData, sizeof(reportData));
+}
+
+void USBHostReportConsumer::processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) {
+  send(_endpoints[SINGLE_ABSOLUTE_MOUSE], &reportData, sizeof(reportData));
+}
+
+static int8_t addMovement(int8_t a, int8_t b) {
+  int sum = a + b;
+  return sum > 127 ? 127 : sum < -128 ? -128 : sum;
+}
+
+void USBHostReportConsumer::send(Endpoint &endpoint, const void* data, size_t length) {
+  uint64_t now = virtualMicros();
+  pollUntil(now);
+  endpoint.sent++;
+  if(endpoint.count < hostQueueDepth()) {
+    QueuedReport &report = endpoint.queue[(endpoint.head + endpoint.count++) % MAX_HOST_QUEUE];
+    memcpy(report.data, data, length);
+    report.sentAt = now;
+    report.cycle = currentCycle();
+    return;
+  }
+
+  QueuedReport &newest = endpoint.queue[(endpoint.head + endpoint.count - 1) % MAX_HOST_QUEUE];
+  if(isHostDropOnOverflow()) {
+    endpoint.dropped++;
+    if(virtualVerbosity >= VERBOSITY_REPORTS) {
+      std::cout << "USB host: " << endpoint.name << " endpoint full (since cycle " << newest.cycle
+        << "), report dropped" << std::endl;
+    }
+    return;
+  }
+  endpoint.coalesced++;
+  if(virtualVerbosity >= VERBOSITY_REPORTS) {
+    std::cout << "USB host: " << endpoint.name << " endpoint full, report coalesced with the one from cycle "
+      << newest.cycle << std::endl;
+  }
+  // The host never sees the queued report, so the new one takes its place; a movement
+  // carries the queued one's along with it
+  HID_MouseReport_Data_t movement;
+  if(endpoint.relative) {
+    const HID_MouseReport_Data_t &queued = *(const HID_MouseReport_Data_t*)newest.data;
+    movement = *(const HID_MouseReport_Data_t*)data;
+    movement.xAxis = addMovement(movement.xAxis, queued.xAxis);
+    movement.yAxis = addMovement(movement.yAxis, queued.yAxis);
+    movement.wheel = addMovement(movement.wheel, queued.wheel);
+    data = &movement;
+  }
+  memcpy(newest.data, data, length);
+  newest.sentAt = now;
+  newest.cycle = currentCycle();
+}
+
+// One poll of every endpoint, at _nextPoll
+void USBHostReportConsumer::poll(void) {
+  uint64_t interval = hostPollMicros();
+  for(unsigned i = 0; i < ENDPOINTS; i++) {
+    Endpoint &endpoint = _endpoints[i];
+    if(!endpoint.count) continue;
+    const QueuedReport &report = endpoint.queue[endpoint.head];
+    endpoint.head = (endpoint.head + 1) % MAX_HOST_QUEUE;
+    endpoint.count--;
+    endpoint.delivered++;
+    uint64_t latency = _nextPoll - report.sentAt;
+    endpoint.totalLatency += latency;
+    if(latency > endpoint.maxLatency) endpoint.maxLatency = latency;
+    // The first poll after it was sent passed it over
+    if(_nextPoll > (report.sentAt / interval + 1) * interval) endpoint.delayed++;
+  }
+}
+
+// Runs every poll up to and including 'now'.  A report sent at 'now' waits for the next one.
+void USBHostReportConsumer::pollUntil(uint64_t now) {
+  uint64_t interval = hostPollMicros();
+  while(_nextPoll <= now) {
+    poll();
+    bool queued = false;
+    for(unsigned i = 0; i < ENDPOINTS; i++) queued |= _endpoints[i].count > 0;
+    // With nothing queued, the polls in between find nothing, so skip straight past them
+    _nextPoll = queued ? _nextPoll + interval : (now / interval + 1) * interval;
+  }
+}
+
+void USBHostReportConsumer::finish(void) {
+  bool queued = true;
+  while(queued) {
+    queued = false;
+    for(unsigned i = 0; i < ENDPOINTS; i++) queued |= _endpoints[i].count > 0;
+    if(!queued) break;
+    poll();
+    _nextPoll += hostPollMicros();
+  }
+
+  if(virtualVerbosity < VERBOSITY_REPORTS) return;
+  std::cout << "USB host model (polling every " << hostPollMicros() << "us, " << hostQueueDepth()
+    << " report(s) per endpoint, " << (isHostDropOnOverflow() ? "dropping" : "coalescing")
+    << " when full):" << std::endl;
+  for(unsigned i = 0; i < ENDPOINTS; i++) {
+    const Endpoint &endpoint = _endpoints[i];
+    if(!endpoint.sent) continue;
+    std::cout << "  " << endpoint.name << ": " << endpoint.sent << " sent, " << endpoint.delivered
+      << " delivered, " << endpoint.coalesced << " coalesced, " << endpoint.dropped << " dropped, "
+      << endpoint.delayed << " delayed";
+    if(endpoint.delivered) {
+      std::cout << "; latency avg " << endpoint.totalLatency / endpoint.delivered << "us, max "
+        << endpoint.maxLatency << "us";
+    }
+    std::cout << std::endl;
+  }
+}
+
+SIMULATION_LOCAL USBHostReportConsumer USBHostModel;
+
+static void finishUSBHostModel(void) { if(hostPollMicros()) USBHostModel.finish(); }
+static AtSimulationEnd usbHostModelAtEnd(finishUSBHostModel);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "HIDReportConsumer.h"
+#include "virtual_io.h"
+
+// A model of the USB host (--host-poll), which polls each interface's endpoint once every
+// hostPollMicros() of virtual time, at fixed frame boundaries.  A report sent by the
+// firmware waits in its endpoint's queue (hostQueueDepth() reports deep) until a poll takes
+// it.  When the firmware sends to a full endpoint, the report is either coalesced with the
+// newest one queued or dropped (--host-overflow).  A report is delayed if a poll passes it
+// over, because others were queued ahead of it.  Each interface's counts, and the latency
+// its delivered reports paid, are printed at exit.
+class USBHostReportConsumer : public HIDReportConsumer_
+{
+   public:
+
+      USBHostReportConsumer(void);
+
+      virtual void processKeyboardReport(const HID_KeyboardReport_Data_t &reportData) override;
+      virtual void processMouseReport(const HID_MouseReport_Data_t &reportData) override;
+      virtual void processConsumerControlReport(const HID_ConsumerControlReport_Data_t &reportData) override;
+      virtual void processSystemControlReport(const HID_SystemControlReport_Data_t &reportData) override;
+      virtual void processSingleAbsoluteMouseReport(const HID_MouseAbsoluteReport_Data_t &reportData) override;
+
+      // Polls until every endpoint is empty, then prints the counts.  Called at the end of the simulation.
+      void finish(void);
+
+   private:
+
+      typedef struct {
+        uint8_t data[sizeof(HID_KeyboardReport_Data_t)];  // the largest report
+        uint64_t sentAt;
+        unsigned cycle;
+      } QueuedReport;
+
+      typedef struct {
+        const char* name;
+        bool relative;  // reports are movements, which add up when coalesced (the mouse)
+        QueuedReport queue[MAX_HOST_QUEUE];
+        unsigned head, count;
+        unsigned long sent, delivered, coalesced, dropped, delayed;
+        uint64_t totalLatency, maxLatency;
+      } Endpoint;
+
+      enum { KEYBOARD, MOUSE, CONSUMER_CONTROL, SYSTEM_CONTROL, SINGLE_ABSOLUTE_MOUSE, ENDPOINTS };
+
+      Endpoint _endpoints[ENDPOINTS];
+      uint64_t _nextPoll;
+
+      void send(Endpoint &endpoint, const void* data, size_t length);
+      void poll(void);
+      void pollUntil(uint64_t now);
+};
+
+extern SIMULATION_LOCAL USBHostReportConsumer USBHostModel;
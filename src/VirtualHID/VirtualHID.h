@@ -1,5 +1,9 @@
 #include "Keyboard.h"
+#include "KeyboardExpectations.h"
 #include "ConsumerControl.h"
 #include "SystemControl.h"
 #include "Mouse.h"
 #include "SingleAbsoluteMouse.h"
+#include "HIDReportConsumer.h"
+#include "USBHostModel.h"
+#include "MouseTrajectory.h"
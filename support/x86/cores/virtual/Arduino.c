@@ -1,25 +1,20 @@
 #include "Arduino.h"
+#include "virtual_clock.h"
 
-// TODO: better time emulation
-// this is pretty hacky, but hopefully helps most code behave sanely
+// Time comes from the virtual clock (see virtual_clock.h), so these only read it, and
+// delays advance it instead of waiting.  Unlike on AVR, unsigned long is 64 bits here,
+// so millis() and micros() don't wrap around.
 unsigned long millis(void) {
-  static unsigned long time = 0;
-  return time++;
+  return virtualMicros() / 1000;
 }
 unsigned long micros(void) {
-  return millis()*1000;
+  return virtualMicros();
 }
 
-
-// yes, these are pretty stupid with the current millis() and micros()
-// but hopefully they stays fine if/when we get a better millis() and micros()
-
 void delay(unsigned long ms) {
-  unsigned long end = millis() + ms;
-  while(millis() < end);
+  advanceVirtualClock((uint64_t)ms * 1000);
 }
 
 void delayMicroseconds(unsigned int us) {
-  unsigned long end = micros() + us;
-  while(micros() < end);
+  advanceVirtualClock(us);
 }
@@ -90,8 +90,12 @@ void yield(void);
 #undef abs
 #endif
 
+// In C++, min() and max() are functions (below), so that they don't break std::min() and
+// std::max() in any standard header included after this one
+#ifndef __cplusplus
 #define min(a,b) ((a)<(b)?(a):(b))
 #define max(a,b) ((a)>(b)?(a):(b))
+#endif
 #define abs(x) ((x)>0?(x):-(x))
 #define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
 #define round(x)     ((x)>=0?(long)((x)+0.5):(long)((x)-0.5))
@@ -231,6 +235,15 @@ extern const uint8_t PROGMEM digital_pin_to_timer_PGM[];
 #endif
 
 #ifdef __cplusplus
+// Like the macros, these take arguments of different types, and give the type the
+// comparison would
+template<class T, class L> constexpr auto min(const T& a, const L& b) -> decltype((b < a) ? b : a) {
+  return (b < a) ? b : a;
+}
+template<class T, class L> constexpr auto max(const T& a, const L& b) -> decltype((b < a) ? b : a) {
+  return (a < b) ? b : a;
+}
+
 #include "WCharacter.h"
 #include "WString.h"
 #include "HardwareSerial.h"
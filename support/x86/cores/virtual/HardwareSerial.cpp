@@ -1,5 +1,6 @@
 #include "HardwareSerial.h"
 #include "Arduino.h"
+#include "virtual_io.h"
 
 // see comments in the real HardwareSerial.cpp
 void serialEvent() __attribute__((weak));
@@ -18,18 +19,19 @@ void serialEventRun(void) {
   if(Serial3_available && serialEvent && Serial3_available()) serialEvent3();
 }
 
-unsigned HardwareSerial::serialNumber = 0;
+SIMULATION_LOCAL unsigned HardwareSerial::serialNumber = 0;
 
 HardwareSerial::HardwareSerial() {}
 
 void HardwareSerial::begin(unsigned long baud, byte config) {
   char filename[64];
-  snprintf(filename, 64, "results/serial_%u.txt", serialNumber++);
-  out = fopen(filename, "w");
+  snprintf(filename, 64, "serial_%u.txt", serialNumber++);
+  out = openResultsFile(filename);
 }
 
 void HardwareSerial::end() {
-  if(out) fclose(out);
+  if(out) closeResultsFile(out);
+  out = NULL;
 }
 
 int HardwareSerial::availableForWrite(void) {
@@ -55,7 +57,7 @@ int HardwareSerial::available(void) {
   return 0;
 }
 
-HardwareSerial Serial;
-HardwareSerial Serial1;
-HardwareSerial Serial2;
-HardwareSerial Serial3;
+SIMULATION_LOCAL HardwareSerial Serial;
+SIMULATION_LOCAL HardwareSerial Serial1;
+SIMULATION_LOCAL HardwareSerial Serial2;
+SIMULATION_LOCAL HardwareSerial Serial3;
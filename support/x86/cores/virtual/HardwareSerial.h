@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Stream.h"
+#include "simulation.h"
 #include <stdio.h>
 
 class HardwareSerial : public Stream {
@@ -23,18 +24,18 @@ class HardwareSerial : public Stream {
     using Print::write;  // write(str) and write(buf, size)
     operator bool() { return true; }
   private:
-    static unsigned serialNumber;
+    static SIMULATION_LOCAL unsigned serialNumber;
     FILE* out;
 };
 // The default Arduino core only provides each of these HardwareSerial objects if
 // various things are #defined.  We always provide them for virtual hardware.
-extern HardwareSerial Serial;
+extern SIMULATION_LOCAL HardwareSerial Serial;
 #define HAVE_HWSERIAL0
-extern HardwareSerial Serial1;
+extern SIMULATION_LOCAL HardwareSerial Serial1;
 #define HAVE_HWSERIAL1
-extern HardwareSerial Serial2;
+extern SIMULATION_LOCAL HardwareSerial Serial2;
 #define HAVE_HWSERIAL2
-extern HardwareSerial Serial3;
+extern SIMULATION_LOCAL HardwareSerial Serial3;
 #define HAVE_HWSERIAL3
 // end HardwareSerial
 
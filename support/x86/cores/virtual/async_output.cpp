@@ -0,0 +1,214 @@
+#include "async_output.h"
+#include "snapshot.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>  // write(), usleep()
+#include <sched.h>  // sched_yield()
+#include <errno.h>
+
+#define RECORD_DATA 124
+#define RING_RECORDS 8192  // a power of two
+#define MAX_STREAMS 16
+#define BATCH_BYTES (64 * 1024)
+
+typedef struct {
+  uint16_t stream;
+  uint16_t length;
+  char data[RECORD_DATA];
+} OutputRecord;
+
+static OutputRecord ring[RING_RECORDS];
+// Snapshots refuse --async-output, so they can leave the ring (most of .bss) out
+static SnapshotExclusion ringNotInSnapshots(ring, sizeof(ring));
+static std::atomic<size_t> head(0);  // the next record to fill; only the simulation thread moves it
+static std::atomic<size_t> tail(0);  // the next record to write out; only the writer thread moves it
+static std::atomic<size_t> written(0);  // every record before this one is out of the process
+static std::atomic<bool> running(false);
+static std::atomic<bool> stopping(false);
+static std::thread writer;
+
+static int streamFds[MAX_STREAMS];
+static unsigned streamCount = 0;
+// What writes to each stream, for flushOnCrash(): its stream buffer, or its FILE while it is open
+static std::streambuf* streamBuffers[MAX_STREAMS];
+static FILE* streamFiles[MAX_STREAMS];
+
+static void writeFully(int fd, const char* data, size_t length) {
+  while(length) {
+    ssize_t put = write(fd, data, length);
+    if(put < 0 && errno == EINTR) continue;
+    if(put <= 0) return;  // nowhere to report it; the output is lost either way
+    data += put;
+    length -= put;
+  }
+}
+
+static void writerLoop(void) {
+  static std::vector<char> batches[MAX_STREAMS];
+  for(unsigned i = 0; i < MAX_STREAMS; i++) batches[i].reserve(BATCH_BYTES);
+  while(true) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    if(t == h) {
+      // Caught up, so write out whatever has been batched
+      for(unsigned i = 0; i < streamCount; i++) {
+        if(batches[i].empty()) continue;
+        writeFully(streamFds[i], &batches[i][0], batches[i].size());
+        batches[i].clear();
+      }
+      written.store(t, std::memory_order_release);
+      if(stopping.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t) return;
+      usleep(100);
+      continue;
+    }
+    for(; t != h; t++) {
+      const OutputRecord &record = ring[t % RING_RECORDS];
+      std::vector<char> &batch = batches[record.stream];
+      if(batch.size() + record.length > BATCH_BYTES) {
+        writeFully(streamFds[record.stream], &batch[0], batch.size());
+        batch.clear();
+      }
+      batch.insert(batch.end(), record.data, record.data + record.length);
+      tail.store(t + 1, std::memory_order_release);
+    }
+  }
+}
+
+static void push(unsigned stream, const char* data, size_t length) {
+  // Before the writer starts and after it stops, output is simply written directly
+  if(!running.load(std::memory_order_relaxed)) {
+    writeFully(streamFds[stream], data, length);
+    return;
+  }
+  while(length) {
+    size_t h = head.load(std::memory_order_relaxed);
+    // Backpressure: if the ring is full, wait for the writer to make room
+    while(h - tail.load(std::memory_order_acquire) == RING_RECORDS) sched_yield();
+    OutputRecord &record = ring[h % RING_RECORDS];
+    size_t n = length < RECORD_DATA ? length : RECORD_DATA;
+    record.stream = stream;
+    record.length = n;
+    memcpy(record.data, data, n);
+    head.store(h + 1, std::memory_order_release);
+    data += n;
+    length -= n;
+  }
+}
+
+void flushAsyncOutput(void) {
+  if(!running.load(std::memory_order_relaxed)) return;
+  size_t h = head.load(std::memory_order_relaxed);
+  while(written.load(std::memory_order_acquire) != h) sched_yield();
+}
+
+static void stopAsyncOutput(void) {
+  if(!running.load(std::memory_order_relaxed)) return;
+  std::cout.flush();
+  fflush(NULL);  // the FILEs from openAsyncFile() hold buffered output too
+  stopping.store(true, std::memory_order_release);
+  writer.join();
+  running.store(false, std::memory_order_relaxed);
+}
+
+// The writer is stopped by a static destructor, once the program is exiting.  Anything
+// written after that (by later destructors) goes out directly, still in order.
+static struct AsyncOutputShutdown {
+  ~AsyncOutputShutdown() { stopAsyncOutput(); }
+} asyncOutputShutdown;
+
+// On a crash, the writer thread is still fine, so push what the streams still hold into the
+// ring, and give the writer a moment to write it all out.  The crash may have come in the
+// middle of a write to one of the FILEs, with its lock held, so they are flushed unlocked.
+static void flushOnCrash(int sig) {
+  for(unsigned i = 0; i < streamCount; i++) {
+    if(streamBuffers[i]) streamBuffers[i]->pubsync();
+    if(streamFiles[i]) fflush_unlocked(streamFiles[i]);
+  }
+  size_t h = head.load(std::memory_order_relaxed);
+  for(int wait = 0; wait < 20000 && written.load(std::memory_order_acquire) != h; wait++) usleep(100);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+bool startAsyncOutput(void) {
+  std::thread started(writerLoop);
+  writer.swap(started);
+  running.store(true, std::memory_order_relaxed);
+  signal(SIGSEGV, flushOnCrash);
+  signal(SIGBUS, flushOnCrash);
+  signal(SIGFPE, flushOnCrash);
+  signal(SIGILL, flushOnCrash);
+  signal(SIGABRT, flushOnCrash);
+  return true;
+}
+
+bool isAsyncOutput(void) { return running.load(std::memory_order_relaxed); }
+
+static int addStream(int fd) {
+  if(streamCount == MAX_STREAMS) {
+    std::cerr << "Error: too many asynchronous output streams" << std::endl;
+    return -1;
+  }
+  streamFds[streamCount] = fd;
+  return streamCount++;
+}
+
+// Collects writes into a record, which is pushed when it fills or on flush (std::endl)
+class AsyncStreambuf : public std::streambuf {
+  public:
+    AsyncStreambuf(unsigned stream) : _stream(stream) {
+      setp(_buffer, _buffer + RECORD_DATA);
+    }
+
+  protected:
+    virtual int overflow(int c) override {
+      sync();
+      if(c != traits_type::eof()) {
+        *pptr() = c;
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+    virtual int sync(void) override {
+      if(pptr() != pbase()) push(_stream, pbase(), pptr() - pbase());
+      setp(_buffer, _buffer + RECORD_DATA);
+      return 0;
+    }
+
+  private:
+    unsigned _stream;
+    char _buffer[RECORD_DATA];
+};
+
+std::streambuf* openAsyncStreambuf(int fd) {
+  int stream = addStream(fd);
+  if(stream < 0) return NULL;
+  streamBuffers[stream] = new AsyncStreambuf(stream);
+  return streamBuffers[stream];
+}
+
+static ssize_t cookieWrite(void* cookie, const char* data, size_t length) {
+  push((uintptr_t)cookie, data, length);
+  return length;
+}
+
+// Only forgets the FILE: the writer may still have its output to write, so the file
+// descriptor stays open until exit
+static int cookieClose(void* cookie) {
+  streamFiles[(uintptr_t)cookie] = NULL;
+  return 0;
+}
+
+FILE* openAsyncFile(int fd) {
+  int stream = addStream(fd);
+  if(stream < 0) return NULL;
+  cookie_io_functions_t functions = { NULL, cookieWrite, NULL, cookieClose };
+  FILE* file = fopencookie((void*)(uintptr_t)stream, "w", functions);
+  if(file) setvbuf(file, NULL, _IOFBF, RECORD_DATA * 32);
+  streamFiles[stream] = file;
+  return file;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+#include <streambuf>
+
+// Asynchronous output (--async-output).  Output to stdout and to the results files is
+// cut into fixed-size records and pushed into a single-producer/single-consumer ring,
+// which a writer thread drains into large write() calls; so the simulation never waits
+// on the terminal or the disk, unless the ring fills up and it has to wait for room.
+// Only the simulation thread may write through these streams.
+bool startAsyncOutput(void);  // Returns TRUE if successful, FALSE if not
+bool isAsyncOutput(void);
+
+// A stream buffer (for an std::ostream) or a stdio FILE that writes to 'fd' through the
+// writer thread.  Neither is ever freed, so that they can be written to during exit.
+std::streambuf* openAsyncStreambuf(int fd);
+FILE* openAsyncFile(int fd);
+
+// Waits until everything written so far is out of the process
+void flushAsyncOutput(void);
@@ -19,6 +19,10 @@
 
 #include <Arduino.h>
 #include "virtual_io.h"
+#include "virtual_context.h"
+#include "virtual_clock.h"
+#include "simulation.h"
+#include "script_runner.h"
 #include <iostream>
 
 // Declared weak in Arduino.h to allow user redefinitions.
@@ -32,11 +36,47 @@ void initVariant() { }
 void setupUSB() __attribute__((weak));
 void setupUSB() { }
 
+uint64_t virtualMicros(void) { return virtualContext->clock; }
+void advanceVirtualClock(uint64_t micros) { virtualContext->clock += micros; }
+
 void init(void) {
   // Arduino core does some device-related setup here.
   // We don't need to do anything.
 }
 
+static void runCycle(void) {
+  if(virtualVerbosity >= VERBOSITY_CYCLES && !isIdleCycle()) std::cout << "Starting cycle " << currentCycle() << std::endl;
+  loop();
+  if (serialEventRun) serialEventRun();
+  nextCycle();
+  advanceVirtualClock(scanPeriodMicros());
+}
+
+#ifdef VIRTUAL_THREADS
+int runSimulation(const char* scriptName, const char* resultsDirectory) {
+  VirtualContext* context = new VirtualContext();
+  virtualContext = context;
+  setResultsDirectory(resultsDirectory);
+  jmp_buf end;
+  context->end = &end;
+  int ended = setjmp(end);
+  if(!ended) {
+    if(!startScript(scriptName)) endSimulation(1);
+    setup();
+    while(true) runCycle();
+  }
+  runSimulationEndHooks();
+  closeScript();
+  virtualContext = NULL;
+  delete context;
+  return ended - 1;
+}
+
+// Weak, so that a test harness linked with the sketch can define a main() of its own, which
+// runs its simulations through runSimulation()
+int main(int argc, char* argv[]) __attribute__((weak));
+#endif
+
 int main(int argc, char* argv[])
 {
     if(!initVirtualInput(argc, argv)) return 1;
@@ -46,13 +86,22 @@ int main(int argc, char* argv[])
 
 	setup();
 
-    while(true) {
-      std::cout << "Starting cycle " << currentCycle() << std::endl;
-      loop();
-      if (serialEventRun) serialEventRun();
-      nextCycle();
+    // Under --fork-server, each script runs in a child forked from here, set up already
+    if(isForkServer() && !runForkServer()) return 1;
+    // Under --minimize, so does each candidate script
+    if(isMinimizing() && !minimizeScript()) return 1;
+
+    // Under --suffixes, the script is a prefix, which runs until it is used up; then each
+    // suffix runs from a snapshot of that point, and ends by coming back here
+    if(isSuffixRun()) {
+      while(!isEndOfInput()) runCycle();
+      jmp_buf end;
+      virtualContext->end = &end;
+      runSuffix(setjmp(end) - 1);
     }
 
+    while(true) runCycle();
+
 	return 0;
 }
 
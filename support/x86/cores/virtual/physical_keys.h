@@ -0,0 +1,71 @@
+#pragma once
+
+// The "physical" names of the virtual keyboard's keys, i.e. the (unshifted) text printed
+// on each key of the standard QWERTY Model 01, with the (row,col) of each.  This is the
+// one list of key names: the hardware's name <-> (row,col) lookups and the key list in
+// printHelp() are all generated from it, by passing a PHYSICAL_KEY(name, row, col) macro.
+#define FOREACH_PHYSICAL_KEY(PHYSICAL_KEY) \
+  PHYSICAL_KEY("prog", 0, 0)               \
+  PHYSICAL_KEY("1", 0, 1)                  \
+  PHYSICAL_KEY("2", 0, 2)                  \
+  PHYSICAL_KEY("3", 0, 3)                  \
+  PHYSICAL_KEY("4", 0, 4)                  \
+  PHYSICAL_KEY("5", 0, 5)                  \
+  PHYSICAL_KEY("led", 0, 6)                \
+  PHYSICAL_KEY("any", 0, 9)                \
+  PHYSICAL_KEY("6", 0, 10)                 \
+  PHYSICAL_KEY("7", 0, 11)                 \
+  PHYSICAL_KEY("8", 0, 12)                 \
+  PHYSICAL_KEY("9", 0, 13)                 \
+  PHYSICAL_KEY("0", 0, 14)                 \
+  PHYSICAL_KEY("num", 0, 15)               \
+  PHYSICAL_KEY("`", 1, 0)                  \
+  PHYSICAL_KEY("q", 1, 1)                  \
+  PHYSICAL_KEY("w", 1, 2)                  \
+  PHYSICAL_KEY("e", 1, 3)                  \
+  PHYSICAL_KEY("r", 1, 4)                  \
+  PHYSICAL_KEY("t", 1, 5)                  \
+  PHYSICAL_KEY("y", 1, 10)                 \
+  PHYSICAL_KEY("u", 1, 11)                 \
+  PHYSICAL_KEY("i", 1, 12)                 \
+  PHYSICAL_KEY("o", 1, 13)                 \
+  PHYSICAL_KEY("p", 1, 14)                 \
+  PHYSICAL_KEY("=", 1, 15)                 \
+  PHYSICAL_KEY("pgup", 2, 0)               \
+  PHYSICAL_KEY("a", 2, 1)                  \
+  PHYSICAL_KEY("s", 2, 2)                  \
+  PHYSICAL_KEY("d", 2, 3)                  \
+  PHYSICAL_KEY("f", 2, 4)                  \
+  PHYSICAL_KEY("g", 2, 5)                  \
+  PHYSICAL_KEY("tab", 1, 6)                \
+  PHYSICAL_KEY("enter", 1, 9)              \
+  PHYSICAL_KEY("h", 2, 10)                 \
+  PHYSICAL_KEY("j", 2, 11)                 \
+  PHYSICAL_KEY("k", 2, 12)                 \
+  PHYSICAL_KEY("l", 2, 13)                 \
+  PHYSICAL_KEY(";", 2, 14)                 \
+  PHYSICAL_KEY("'", 2, 15)                 \
+  PHYSICAL_KEY("pgdn", 3, 0)               \
+  PHYSICAL_KEY("z", 3, 1)                  \
+  PHYSICAL_KEY("x", 3, 2)                  \
+  PHYSICAL_KEY("c", 3, 3)                  \
+  PHYSICAL_KEY("v", 3, 4)                  \
+  PHYSICAL_KEY("b", 3, 5)                  \
+  PHYSICAL_KEY("esc", 2, 6)  /* yes, row 2 */ \
+  PHYSICAL_KEY("fly", 2, 9)  /* yes, row 2 */ \
+  PHYSICAL_KEY("n", 3, 10)                 \
+  PHYSICAL_KEY("m", 3, 11)                 \
+  PHYSICAL_KEY(",", 3, 12)                 \
+  PHYSICAL_KEY(".", 3, 13)                 \
+  PHYSICAL_KEY("/", 3, 14)                 \
+  PHYSICAL_KEY("-", 3, 15)                 \
+  PHYSICAL_KEY("lctrl", 0, 7)              \
+  PHYSICAL_KEY("bksp", 1, 7)               \
+  PHYSICAL_KEY("cmd", 2, 7)                \
+  PHYSICAL_KEY("lshift", 3, 7)             \
+  PHYSICAL_KEY("lfn", 3, 6)                \
+  PHYSICAL_KEY("rshift", 3, 8)             \
+  PHYSICAL_KEY("alt", 2, 8)                \
+  PHYSICAL_KEY("space", 1, 8)              \
+  PHYSICAL_KEY("rctrl", 0, 8)              \
+  PHYSICAL_KEY("rfn", 3, 9)
@@ -0,0 +1,669 @@
+#include "script_runner.h"
+#include "virtual_io.h"
+#include "virtual_context.h"
+#include "snapshot.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>  // opendir()
+#include <sys/stat.h>  // stat(), mkdir()
+#include <sys/wait.h>  // waitpid()
+#include <sys/mman.h>  // memfd_create()
+#include <fcntl.h>  // open()
+#include <unistd.h>  // fork(), dup2(), pipe(), alarm()
+#include <time.h>  // clock_gettime()
+#include <errno.h>
+
+typedef struct {
+  std::string path;
+  std::string name;  // of its results directory
+  off_t size;
+  pid_t pid;
+  int status;  // as from waitpid(), or -1 if it couldn't be started
+  struct timespec started;
+  double seconds;
+} Script;
+
+// Static, as a worker's script path outlives runScripts()
+static std::vector<Script> scripts;
+
+static void addScript(const std::string &path, off_t size) {
+  Script script;
+  script.path = path;
+  size_t slash = path.find_last_of('/');
+  std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+  script.name = base;
+  // Scripts from different directories can share a name, but not a results directory; nor
+  // can a script have the summary's name, as results/summary.txt is the summary
+  for(unsigned n = 2; ; n++) {
+    bool taken = script.name == "summary.txt";
+    for(size_t i = 0; i < scripts.size() && !taken; i++) taken = scripts[i].name == script.name;
+    if(!taken) break;
+    script.name = base + "_" + std::to_string(n);
+  }
+  script.size = size;
+  script.pid = 0;
+  script.status = -1;
+  script.seconds = 0;
+  scripts.push_back(script);
+}
+
+static bool findScripts(const char* path) {
+  struct stat info;
+  if(stat(path, &info)) {
+    std::cerr << "Error: can't find script \"" << path << "\"" << std::endl;
+    return false;
+  }
+  if(!S_ISDIR(info.st_mode)) {
+    addScript(path, info.st_size);
+    return true;
+  }
+  DIR* dir = opendir(path);
+  if(!dir) {
+    std::cerr << "Error opening directory \"" << path << "\", errno " << errno << std::endl;
+    return false;
+  }
+  std::vector<std::string> names;
+  while(struct dirent* entry = readdir(dir)) {
+    if(entry->d_name[0] != '.') names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for(size_t i = 0; i < names.size(); i++) {
+    std::string file = std::string(path) + "/" + names[i];
+    if(stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) addScript(file, info.st_size);
+  }
+  return true;
+}
+
+// Sends stdout (and stderr, if 'withErrors') to stdout.txt in 'dir'
+static void redirectOutput(const std::string &dir, bool withErrors) {
+  int fd = open((dir + "/stdout.txt").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) return;
+  dup2(fd, STDOUT_FILENO);
+  if(withErrors) dup2(fd, STDERR_FILENO);
+  close(fd);
+}
+
+static bool longerScript(size_t a, size_t b) { return scripts[a].size > scripts[b].size; }
+
+static void printOutcome(std::ostream &out, const Script &script) {
+  char outcome[32], line[64];
+  if(script.status < 0) snprintf(outcome, sizeof(outcome), "NOT RUN");
+  else if(WIFEXITED(script.status) && WEXITSTATUS(script.status) == 0) snprintf(outcome, sizeof(outcome), "ok");
+  else if(WIFEXITED(script.status)) snprintf(outcome, sizeof(outcome), "FAILED (exit %d)", WEXITSTATUS(script.status));
+  else snprintf(outcome, sizeof(outcome), "CRASHED (signal %d)", WTERMSIG(script.status));
+  snprintf(line, sizeof(line), "%-20s %9.3fs  ", outcome, script.seconds);
+  out << line << script.path << "  (results/" << script.name << ")" << std::endl;
+}
+
+static double secondsSince(const struct timespec &started) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+}
+
+// The summary, in the order the scripts were given.  Returns TRUE if every script succeeded
+// and the summary was written, FALSE if not.
+static bool writeSummary(void) {
+  std::ofstream summary("results/summary.txt");
+  unsigned failed = 0;
+  for(size_t i = 0; i < scripts.size(); i++) {
+    const Script &script = scripts[i];
+    bool ok = script.status >= 0 && WIFEXITED(script.status) && WEXITSTATUS(script.status) == 0;
+    if(!ok) failed++;
+    printOutcome(summary, script);
+    if(!ok || virtualVerbosity >= VERBOSITY_REPORTS) printOutcome(std::cout, script);
+  }
+  summary << scripts.size() << " scripts, " << failed << " failed" << std::endl;
+  summary.close();
+  std::cout << scripts.size() << " scripts, " << failed << " failed";
+  if(summary) std::cout << " (see results/summary.txt)";
+  std::cout << std::endl;
+  if(!summary) std::cerr << "Error writing \"results/summary.txt\"" << std::endl;
+  std::cout.flush();
+  return !failed && summary;
+}
+
+const char* runScripts(int count, char* paths[], unsigned jobs) {
+  for(int i = 0; i < count; i++) {
+    if(!findScripts(paths[i])) return NULL;
+  }
+  if(scripts.empty()) {
+    std::cerr << "Error: no scripts to run" << std::endl;
+    return NULL;
+  }
+  if(mkdir("results", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    std::cerr << "Error creating directory 'results', errno " << errno << std::endl;
+    return NULL;
+  }
+
+  // Longest first, so that the last scripts to start are the quick ones
+  std::vector<size_t> order;
+  for(size_t i = 0; i < scripts.size(); i++) order.push_back(i);
+  std::stable_sort(order.begin(), order.end(), longerScript);
+
+  size_t next = 0;
+  unsigned running = 0;
+  while(next < order.size() || running) {
+    while(running < jobs && next < order.size()) {
+      Script &script = scripts[order[next++]];
+      std::string dir = "results/" + script.name;
+      if(mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+        std::cerr << "Error creating directory '" << dir << "', errno " << errno << std::endl;
+        continue;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &script.started);
+      std::cout.flush();
+      pid_t pid = fork();
+      if(pid < 0) {
+        std::cerr << "Error forking worker for \"" << script.path << "\", errno " << errno << std::endl;
+        continue;
+      }
+      if(pid == 0) {
+        redirectOutput(dir, true);
+        setResultsDirectory(dir.c_str());
+        return script.path.c_str();
+      }
+      script.pid = pid;
+      running++;
+    }
+    if(!running) break;
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if(pid < 0) {
+      if(errno == EINTR) continue;
+      std::cerr << "Error waiting for workers, errno " << errno << std::endl;
+      _exit(1);
+    }
+    for(size_t i = 0; i < scripts.size(); i++) {
+      if(scripts[i].pid != pid) continue;
+      scripts[i].status = status;
+      scripts[i].seconds = secondsSince(scripts[i].started);
+      running--;
+    }
+  }
+
+  // The sketch never ran here, so none of its exit-time output (lazy reports, analyses)
+  // belongs to this process
+  _exit(writeSummary() ? 0 : 1);
+}
+
+static int replyFd = -1;
+
+bool startForkServer(void) {
+  replyFd = dup(STDOUT_FILENO);
+  int fd = open("results/setup.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(replyFd < 0 || fd < 0) {
+    std::cerr << "Error starting fork server, errno " << errno << std::endl;
+    return false;
+  }
+  dup2(fd, STDOUT_FILENO);
+  close(fd);
+  return true;
+}
+
+static void reply(const char* text) {
+  size_t length = strlen(text);
+  while(length) {
+    ssize_t put = write(replyFd, text, length);
+    if(put < 0 && errno == EINTR) continue;
+    if(put <= 0) _exit(1);  // nobody is listening any more
+    text += put;
+    length -= put;
+  }
+}
+
+bool runForkServer(void) {
+  // Whatever setup() wrote is out before the first fork, so no child writes it again
+  std::cout.flush();
+  fflush(NULL);
+  char line[8192];
+  while(fgets(line, sizeof(line), stdin)) {
+    size_t length = strcspn(line, "\r\n");
+    line[length] = '\0';
+    if(!length) continue;
+    char* tab = strchr(line, '\t');
+    if(tab) *tab = '\0';
+    std::string dir = tab && tab[1] ? tab + 1 : "results";
+
+    pid_t pid = fork();
+    if(pid < 0) {
+      std::cerr << "Error forking child for \"" << line << "\", errno " << errno << std::endl;
+      reply("error\n");
+      continue;
+    }
+    if(pid == 0) {
+      close(replyFd);
+      int devNull = open("/dev/null", O_RDONLY);
+      if(devNull >= 0) {
+        dup2(devNull, STDIN_FILENO);
+        close(devNull);
+      }
+      if(mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+        std::cerr << "Error creating directory '" << dir << "', errno " << errno << std::endl;
+        return false;
+      }
+      redirectOutput(dir, true);
+      // The files setup() opened (serial output) now belong in this script's results, each
+      // with what setup() wrote to it
+      return reopenResultsFiles(dir.c_str()) && startScript(line);
+    }
+
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+      if(errno != EINTR) _exit(1);
+    }
+    char outcome[32];
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0) snprintf(outcome, sizeof(outcome), "ok\n");
+    else if(WIFEXITED(status)) snprintf(outcome, sizeof(outcome), "exit %d\n", WEXITSTATUS(status));
+    else snprintf(outcome, sizeof(outcome), "signal %d\n", WTERMSIG(status));
+    reply(outcome);
+  }
+  // The sketch's exit-time output would describe setup() alone, so skip it
+  fflush(NULL);
+  _exit(0);
+}
+
+bool findSuffixes(const char* path) {
+  if(!findScripts(path)) return false;
+  if(scripts.empty()) {
+    std::cerr << "Error: no suffix scripts in \"" << path << "\"" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The runner's own state, which restore() leaves alone: the suffix running, and the real
+// stdout and stderr, for the summary
+static size_t suffix = 0;
+static SnapshotExclusion suffixNotInSnapshots(&suffix, sizeof(suffix));
+static int stdoutFd = -1, stderrFd = -1;
+
+static void restoreOutput(void) {
+  std::cout.flush();
+  fflush(NULL);
+  dup2(stdoutFd, STDOUT_FILENO);
+  dup2(stderrFd, STDERR_FILENO);
+}
+
+void runSuffix(int status) {
+  VirtualContext &context = *virtualContext;
+  if(status < 0) {
+    // The prefix is used up.  Its output is all written out, so that each suffix's
+    // results can start with a copy of it, and the simulation is snapshotted.
+    closeInput();
+    flushUSBLog();
+    std::cout.flush();
+    fflush(NULL);
+    stdoutFd = dup(STDOUT_FILENO);
+    stderrFd = dup(STDERR_FILENO);
+    if(stdoutFd < 0 || stderrFd < 0 || !snapshot()) {
+      std::cerr << "Error: can't snapshot the end of the prefix script" << std::endl;
+      exit(1);
+    }
+  } else {
+    runSimulationEndHooks();
+    closeInput();
+    scripts[suffix].status = W_EXITCODE(status, 0);
+    scripts[suffix].seconds = secondsSince(scripts[suffix].started);
+    restoreOutput();
+    suffix++;
+  }
+
+  // Results files opened since the snapshot aren't in it, so they are closed here
+  FILE* open[MAX_RESULTS_FILES];
+  unsigned openCount = context.resultsFileCount;
+  memcpy(open, context.resultsFiles, sizeof(open));
+  for(; suffix < scripts.size(); suffix++) {
+    restore();
+    for(unsigned i = 0; i < openCount; i++) {
+      bool kept = false;
+      for(unsigned j = 0; j < context.resultsFileCount && !kept; j++) kept = context.resultsFiles[j] == open[i];
+      if(!kept) fclose(open[i]);
+    }
+    openCount = context.resultsFileCount;
+    memcpy(open, context.resultsFiles, sizeof(open));
+
+    Script &script = scripts[suffix];
+    std::string dir = "results/" + script.name;
+    if(mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+      std::cerr << "Error creating directory '" << dir << "', errno " << errno << std::endl;
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &script.started);
+    redirectOutput(dir, true);
+    if(moveResultsFiles(dir.c_str()) && continueScript(script.path.c_str())) return;
+    restoreOutput();
+  }
+
+  // The last suffix's exit-time output has been written already
+  _exit(writeSummary() ? 0 : 1);
+}
+
+#define MINIMIZE_DIRECTORY "results/minimize"
+#define MINIMIZED_SCRIPT "results/minimized.txt"
+#define WHOLE_LINE ((size_t)-1)
+
+// The script being minimized, a line (scan cycle) at a time
+typedef struct {
+  bool dropped;
+  std::vector<std::string> commands;
+  std::vector<bool> commandDropped;
+  std::string expectation;  // empty if there is none
+} ScriptLine;
+
+// A line, or one command in it, that the minimizer may drop
+typedef struct {
+  size_t line;
+  size_t command;  // WHOLE_LINE for the line itself
+} ScriptPart;
+
+static std::string minimizedScript;
+static std::vector<ScriptLine> lines;
+static bool keepCrash = false;
+static int failure;  // how the script itself ended, as from waitpid()
+static std::string failureText;  // how its EXPECT failed (see readFailure()), unless keepCrash
+static unsigned candidates = 0;
+static unsigned candidateTimeout = 0;  // seconds; 0 for none
+static bool finalRun = false;  // the minimized script, run with its output as usual
+static jmp_buf candidateStart;  // in minimizeScript(), where each candidate's child goes
+
+// Candidates never touch the disk: each is written to a memory file, and its stdout and
+// stderr go down a pipe to the minimizer, which only looks for how an EXPECT failed
+static int candidateScript = -1;
+static int candidateOutput = -1;  // in the child, the pipe's write end
+static std::string candidateFailure;  // how the last candidate's EXPECT failed, if one did
+
+bool startMinimizer(const char* scriptName, bool crash) {
+  std::ifstream in(scriptName, std::ios::binary);
+  if(!in) {
+    std::cerr << "Error opening script \"" << scriptName << "\"" << std::endl;
+    return false;
+  }
+  std::string script((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if(script.compare(0, 4, MATRIX_FRAME_MAGIC) == 0) {
+    std::cerr << "Error: --minimize needs a text script, and \"" << scriptName << "\" is a frame script" << std::endl;
+    return false;
+  }
+  for(size_t pos = 0; pos < script.size(); ) {
+    size_t newline = script.find('\n', pos);
+    if(newline == std::string::npos) newline = script.size();
+    InputSlice line = {script.data() + pos, newline - pos}, command;
+    if(line.length && line.data[line.length - 1] == '\r') line.length--;
+    pos = newline + 1;
+
+    ScriptLine scriptLine;
+    scriptLine.dropped = false;
+    bool expectation;
+    while(nextScriptCommand(line, command, expectation)) {
+      if(expectation) scriptLine.expectation.assign(command.data, command.length);
+      else scriptLine.commands.push_back(std::string(command.data, command.length));
+    }
+    scriptLine.commandDropped.assign(scriptLine.commands.size(), false);
+    lines.push_back(scriptLine);
+  }
+  if(mkdir(MINIMIZE_DIRECTORY, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    std::cerr << "Error creating directory '" MINIMIZE_DIRECTORY "', errno " << errno << std::endl;
+    return false;
+  }
+  candidateScript = memfd_create("candidate", 0);
+  if(candidateScript < 0) {
+    std::cerr << "Error creating candidate script, errno " << errno << std::endl;
+    return false;
+  }
+  minimizedScript = scriptName;
+  keepCrash = crash;
+  return true;
+}
+
+// The script as it stands
+static std::string scriptText(void) {
+  std::ostringstream out;
+  for(size_t i = 0; i < lines.size(); i++) {
+    const ScriptLine &line = lines[i];
+    if(line.dropped) continue;
+    const char* separator = "";
+    for(size_t j = 0; j < line.commands.size(); j++) {
+      if(line.commandDropped[j]) continue;
+      out << separator << line.commands[j];
+      separator = " ";
+    }
+    if(!line.expectation.empty()) out << separator << line.expectation;
+    out << '\n';
+  }
+  return out.str();
+}
+
+// Counts the lines left, and the commands left in them
+static void countScript(size_t &lineCount, size_t &commandCount) {
+  lineCount = commandCount = 0;
+  for(size_t i = 0; i < lines.size(); i++) {
+    if(lines[i].dropped) continue;
+    lineCount++;
+    for(size_t j = 0; j < lines[i].commands.size(); j++) commandCount += !lines[i].commandDropped[j];
+  }
+}
+
+// Reads a candidate's output to the end, and returns how its first EXPECT failed: the
+// "EXPECT failed" line, with the keys expected, and the "host has keys" line, with what the
+// host had instead.  The cycle numbers between them are left out, as dropping lines moves
+// them.  Returns "" if no EXPECT failed.
+static std::string readFailure(int fd) {
+  std::string output, failure;
+  bool complete = false;  // both lines are in 'failure'
+  char buffer[4096];
+  ssize_t got;
+  while((got = read(fd, buffer, sizeof(buffer))) != 0) {
+    if(got < 0 && errno == EINTR) continue;
+    if(got < 0) break;
+    if(complete) continue;
+    output.append(buffer, got);
+    // Lines are only looked at whole, and only the current one is kept
+    size_t newline;
+    while(!complete && (newline = output.find('\n')) != std::string::npos) {
+      if(failure.empty()) {
+        if(output.compare(0, 14, "EXPECT failed:") == 0) failure = output.substr(0, newline);
+      } else if(output.compare(0, 16, "  host has keys:") == 0) {
+        failure += '\n' + output.substr(0, newline);
+        complete = true;
+      }
+      output.erase(0, newline + 1);
+    }
+  }
+  return failure;
+}
+
+// Runs the script as it stands in a child, and returns how that ended, as from waitpid(),
+// or -1 if it couldn't be run.  The child goes back to minimizeScript() to start it.
+static int runCandidate(void) {
+  std::string text = scriptText();
+  int output[2];
+  if(ftruncate(candidateScript, 0) || pwrite(candidateScript, text.data(), text.size(), 0) != (ssize_t)text.size()
+      || pipe(output)) {
+    std::cerr << "Error writing candidate script, errno " << errno << std::endl;
+    return -1;
+  }
+  candidates++;
+  std::cout.flush();
+  fflush(NULL);
+  pid_t pid = fork();
+  if(pid < 0) {
+    std::cerr << "Error forking candidate script, errno " << errno << std::endl;
+    close(output[0]);
+    close(output[1]);
+    return -1;
+  }
+  if(pid == 0) {
+    close(output[0]);
+    candidateOutput = output[1];
+    longjmp(candidateStart, 1);
+  }
+  close(output[1]);
+  candidateFailure = readFailure(output[0]);
+  close(output[0]);
+  int status;
+  while(waitpid(pid, &status, 0) < 0) {
+    if(errno != EINTR) return -1;
+  }
+  return status;
+}
+
+static bool stillFails(void) {
+  int status = runCandidate();
+  if(status < 0) return false;
+  if(keepCrash) return WIFSIGNALED(status) && WTERMSIG(status) == WTERMSIG(failure);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 1 && candidateFailure == failureText;
+}
+
+static void setDropped(const ScriptPart &part, bool dropped) {
+  if(part.command == WHOLE_LINE) lines[part.line].dropped = dropped;
+  else lines[part.line].commandDropped[part.command] = dropped;
+}
+
+// Drops every one of 'parts' not marked in 'keep'.  If the script still fails, that
+// stands, and it returns TRUE; if not, they are put back.
+static bool tryDropping(const std::vector<ScriptPart> &parts, const std::vector<bool> &keep) {
+  for(size_t i = 0; i < parts.size(); i++) setDropped(parts[i], !keep[i]);
+  if(stillFails()) return true;
+  for(size_t i = 0; i < parts.size(); i++) setDropped(parts[i], false);
+  return false;
+}
+
+// Delta debugging (ddmin): splits 'parts' into n chunks, and tries keeping just one chunk,
+// then dropping just one; whenever neither works for any chunk, the chunks are halved, down
+// to single parts.  Returns TRUE if anything was dropped.
+static bool ddmin(std::vector<ScriptPart> parts) {
+  size_t before = parts.size();
+  std::vector<bool> keep(parts.size(), false);
+  if(!parts.empty() && tryDropping(parts, keep)) return true;
+  size_t n = 2;
+  while(parts.size() >= 2) {
+    n = std::min(n, parts.size());
+    bool reduced = false;
+    for(int complement = 0; complement < 2 && !reduced; complement++) {
+      if(complement && n == 2) break;  // the complements of two chunks are the chunks
+      for(size_t i = 0; i < n && !reduced; i++) {
+        size_t start = parts.size() * i / n, end = parts.size() * (i + 1) / n;
+        keep.resize(parts.size());
+        for(size_t j = 0; j < parts.size(); j++) keep[j] = (j >= start && j < end) != (complement == 1);
+        if(!tryDropping(parts, keep)) continue;
+        std::vector<ScriptPart> kept;
+        for(size_t j = 0; j < parts.size(); j++) {
+          if(keep[j]) kept.push_back(parts[j]);
+        }
+        parts.swap(kept);
+        n = complement ? std::max(n - 1, (size_t)2) : 2;
+        reduced = true;
+      }
+    }
+    if(!reduced) {
+      if(n == parts.size()) break;
+      n = std::min(2 * n, parts.size());
+    }
+  }
+  return parts.size() < before;
+}
+
+// Whole lines first, as dropping one can take any number of commands with it
+static bool minimizeLines(void) {
+  std::vector<ScriptPart> parts;
+  for(size_t i = 0; i < lines.size(); i++) {
+    if(!lines[i].dropped && lines[i].expectation.empty()) parts.push_back({i, WHOLE_LINE});
+  }
+  return ddmin(parts);
+}
+
+// Then the commands in the lines left, which leaves each line's scan cycle where it is
+static bool minimizeCommands(void) {
+  std::vector<ScriptPart> parts;
+  for(size_t i = 0; i < lines.size(); i++) {
+    if(lines[i].dropped) continue;
+    for(size_t j = 0; j < lines[i].commands.size(); j++) {
+      if(!lines[i].commandDropped[j]) parts.push_back({i, j});
+    }
+  }
+  return ddmin(parts);
+}
+
+bool minimizeScript(void) {
+  if(setjmp(candidateStart)) {
+    // A candidate's child, from runCandidate()
+    int devNull = open("/dev/null", O_RDONLY);
+    if(devNull >= 0) {
+      dup2(devNull, STDIN_FILENO);
+      close(devNull);
+    }
+    if(finalRun) {
+      close(candidateOutput);
+      redirectOutput(MINIMIZE_DIRECTORY, true);
+      return reopenResultsFiles(MINIMIZE_DIRECTORY) && startScript(MINIMIZED_SCRIPT);
+    }
+    dup2(candidateOutput, STDOUT_FILENO);
+    dup2(candidateOutput, STDERR_FILENO);
+    close(candidateOutput);
+    // Only errors matter, and a candidate that is stuck is no reproducer
+    virtualVerbosity = VERBOSITY_SILENT;
+    if(candidateTimeout) alarm(candidateTimeout);
+    char script[32];
+    snprintf(script, sizeof(script), "/proc/self/fd/%d", candidateScript);
+    return reopenResultsFiles(MINIMIZE_DIRECTORY) && startScript(script);
+  }
+
+  // Whatever setup() wrote is out before the first fork, so no child writes it again
+  std::cout.flush();
+  fflush(NULL);
+  struct timespec started;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  failure = runCandidate();
+  if(!keepCrash && failure >= 0 && WIFEXITED(failure) && WEXITSTATUS(failure) == 1) failureText = candidateFailure;
+  if(failure < 0 || (keepCrash ? !WIFSIGNALED(failure) : failureText.empty())) {
+    if(failure >= 0) {
+      std::cerr << "Error: \"" << minimizedScript << "\" doesn't " << (keepCrash ? "crash" : "fail an EXPECT");
+      if(WIFSIGNALED(failure)) std::cerr << " (it was killed by signal " << WTERMSIG(failure) << ")" << std::endl;
+      else std::cerr << " (it ended with exit status " << WEXITSTATUS(failure) << ")" << std::endl;
+    }
+    _exit(1);
+  }
+  // Ten times as long as the script itself took, or a second, is long enough
+  candidateTimeout = 10 * secondsSince(started) + 1;
+
+  size_t lineCount, commandCount;
+  countScript(lineCount, commandCount);
+  bool reduced;
+  do {
+    reduced = minimizeLines();
+    reduced = minimizeCommands() || reduced;
+  } while(reduced);
+  double seconds = secondsSince(started);
+
+  size_t minimizedLines, minimizedCommands;
+  countScript(minimizedLines, minimizedCommands);
+  std::ofstream minimized(MINIMIZED_SCRIPT);
+  minimized << scriptText();
+  minimized.close();
+  if(!minimized) {
+    std::cerr << "Error writing \"" MINIMIZED_SCRIPT "\"" << std::endl;
+    _exit(1);
+  }
+  finalRun = true;
+  runCandidate();
+
+  std::cout << "Minimized \"" << minimizedScript << "\" from " << lineCount << " lines (" << commandCount
+    << " commands) to " << minimizedLines << " lines (" << minimizedCommands << " commands), in "
+    << candidates << " runs over " << seconds << "s (" << seconds * 1e6 / candidates << "us each)" << std::endl;
+  if(keepCrash) std::cout << "It is killed by signal " << WTERMSIG(failure) << " (" << strsignal(WTERMSIG(failure)) << ")" << std::endl;
+  else std::cout << "It fails with:\n" << failureText << std::endl;
+  std::cout << "The minimized script is in " MINIMIZED_SCRIPT ", and its output in " MINIMIZE_DIRECTORY "/stdout.txt" << std::endl;
+  std::cout.flush();
+  // The sketch's exit-time output would describe setup() alone, so skip it
+  fflush(NULL);
+  _exit(0);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// The parallel script runner (-r).  Each script still runs in a process of its own, since
+// the sketch's state lives in globals; the runner forks up to 'jobs' of them at a time
+// (--jobs, the number of cores by default), longest script first by file size, and gives
+// each free worker the longest script left as soon as it finishes, so no core sits idle
+// while there is work.  Each script's results, and its stdout and stderr (stdout.txt),
+// go to a directory of its own, results/<script name> (with a number added if another
+// script, or the summary, has that name already); once they have all finished, a
+// summary of every script's outcome is printed and written to results/summary.txt.
+//
+// 'paths' are scripts, or directories whose (non-hidden) files are all scripts.  In the
+// parent, runScripts() never returns: it exits with status 0 if every script succeeded,
+// or 1 if any failed or the summary couldn't be written.  In each worker it returns the worker's script, with its stdout,
+// stderr and results directory already set up, to be run like any other; or on an
+// error before any worker starts, it returns NULL.
+const char* runScripts(int count, char* paths[], unsigned jobs);
+
+// The fork server (--fork-server).  startForkServer() is called before setup(), and sends
+// setup()'s stdout to results/setup.txt, keeping the real stdout for its replies.  Then
+// runForkServer(), called once setup() is done, reads script filenames from stdin, one per
+// line, each optionally followed by a tab and the results directory to use for it.  It
+// forks a child for each, which starts from the set-up sketch; once the child is done, it
+// replies "ok", "exit N" or "signal N" on stdout.  In the server, runForkServer() never
+// returns: it exits at the end of stdin.  In each child, it returns TRUE once the script
+// has been started, or FALSE if it couldn't be.
+bool startForkServer(void);  // Returns TRUE if successful, FALSE if not
+bool runForkServer(void);
+
+// Suffix runs (--suffixes).  findSuffixes() is given a script, or a directory of them, as
+// for -r.  The main script is the prefix, and is run as usual until it is used up; then
+// runSuffix() is called with a 'status' of -1, and snapshots the simulation there (see
+// snapshot.h).  It restores the snapshot, starts the first suffix in its place, and
+// returns, for the scan cycles to go on; when that suffix ends (endSimulation()), it is
+// called again with the suffix's exit status, and so on.  Each suffix's results start as a
+// copy of the prefix's, and go to results/<suffix name>, with its stdout and stderr
+// (stdout.txt); after the last one, it writes the summary just as -r does, and exits.
+bool findSuffixes(const char* path);  // Returns TRUE if successful, FALSE if not
+void runSuffix(int status);
+
+// The minimizer (--minimize).  startMinimizer() is given a text script that fails, and
+// which way its failure must stay the same: the same EXPECT failing with the host having
+// the same keys (its "EXPECT failed" and "host has keys" lines), or with 'crash', being
+// killed by the same signal.  Then minimizeScript(), called once setup() is done, runs
+// delta debugging (ddmin) over the script: first over its lines,
+// which are scan cycles, dropping whole ones, then over the commands left in them (keys,
+// T, D, U, C, Q and waits), until dropping any one line or command would lose the failure.
+// Lines with an EXPECT are never dropped, and neither is the EXPECT itself.  Each candidate
+// script runs in a child forked from the set-up sketch, as under --fork-server, taking its
+// script from a memory file and sending its output down a pipe, with its results in
+// results/minimize.  The smallest script that still fails is written to
+// results/minimized.txt, and run once more for its output (results/minimize/stdout.txt).
+// In the minimizer, minimizeScript() never returns: it exits with status 0 if the script
+// failed to begin with, or 1 if not.  In each child, it returns TRUE once the candidate
+// has been started, or FALSE if it couldn't be.
+bool startMinimizer(const char* scriptName, bool crash);  // Returns TRUE if successful, FALSE if not
+bool minimizeScript(void);
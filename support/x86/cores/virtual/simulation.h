@@ -0,0 +1,46 @@
+#pragma once
+
+// Simulations, for the core, VirtualHID, and sketches.  A program normally runs one
+// simulation, on the main thread, from main() until the process exits.  Built with
+// VIRTUAL_THREADS defined (the "Simulations" menu in boards.txt), it can instead run any
+// number at once, each on a thread of its own, through runSimulation().
+//
+// The core keeps its own state for each simulation in a VirtualContext (virtual_context.h).
+// Any other global or static that belongs to a simulation, rather than to the program, is
+// declared SIMULATION_LOCAL: with VIRTUAL_THREADS, that makes it thread_local, so that each
+// simulation's thread has a copy of its own, set up from scratch.  The HID objects (Keyboard,
+// Mouse, ...), Serial, and the matrix state behind KeyboardHardware are all declared that
+// way; so must be the sketch's own globals, and those of any plugin it uses, for a sketch
+// to run in threads.  Without VIRTUAL_THREADS, SIMULATION_LOCAL is nothing at all.
+#ifdef VIRTUAL_THREADS
+#define SIMULATION_LOCAL thread_local
+#else
+#define SIMULATION_LOCAL
+#endif
+
+// Something to do at the end of every simulation, such as writing out an analysis: a
+// static AtSimulationEnd, constructed with the function to call, calls it at exit, in the
+// place of a static destructor, and runSimulation() calls it as each simulation ends.
+// Hooks run in the reverse of the order their AtSimulationEnds were constructed.
+typedef void (*SimulationEndHook)(void);
+class AtSimulationEnd {
+  public:
+    AtSimulationEnd(SimulationEndHook hook);
+    ~AtSimulationEnd();
+  private:
+    SimulationEndHook _hook;
+};
+
+// Ends this simulation with exit status 'status': exits the process, or under
+// runSimulation(), returns 'status' from it
+void endSimulation(int status) __attribute__((noreturn));
+
+#ifdef VIRTUAL_THREADS
+// Runs the script in a new simulation on this thread, with its results in 'resultsDirectory',
+// and returns its exit status once it ends.  It is for a test harness's own main(), which
+// takes the place of the core's (weak, in this build): see test/threads.  The thread must be one of its own, used for no
+// other simulation, since the SIMULATION_LOCAL objects it starts with are the ones it has
+// when the simulation ends.  Interactive input, --async-output and --verify-sparse-scan
+// are for one simulation per process, and are refused.
+int runSimulation(const char* scriptName, const char* resultsDirectory);
+#endif
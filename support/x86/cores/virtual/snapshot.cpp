@@ -0,0 +1,159 @@
+#include "snapshot.h"
+#include "virtual_io.h"
+#include "async_output.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>  // sysconf()
+#include <link.h>  // dl_iterate_phdr()
+
+#define MAX_SNAPSHOT_EXCLUSIONS 64
+
+#if defined(__x86_64__)
+typedef ElfW(Rela) Relocation;
+#define DT_RELOCATIONS DT_RELA
+#define DT_RELOCATIONS_SIZE DT_RELASZ
+#define COPY_RELOCATION R_X86_64_COPY
+#define RELOCATION_TYPE ELF64_R_TYPE
+#define RELOCATION_SYMBOL ELF64_R_SYM
+#elif defined(__i386__)
+typedef ElfW(Rel) Relocation;
+#define DT_RELOCATIONS DT_REL
+#define DT_RELOCATIONS_SIZE DT_RELSZ
+#define COPY_RELOCATION R_386_COPY
+#define RELOCATION_TYPE ELF32_R_TYPE
+#define RELOCATION_SYMBOL ELF32_R_SYM
+#endif
+
+typedef struct {
+  uintptr_t start, end;
+} Range;
+
+// Filled in by static constructors
+static SnapshotExclusion* exclusions[MAX_SNAPSHOT_EXCLUSIONS];
+static unsigned exclusionCount = 0;
+
+// These are worked out by the first snapshot(), and never change after that, so copying
+// them back leaves them as they are
+static std::vector<Range> excluded;
+static std::vector<Range> pieces;  // of the data segments, less what is excluded
+static std::vector<char> arena;
+static bool haveSnapshot = false;
+
+SnapshotExclusion::SnapshotExclusion(const void* object, size_t size)
+  :  _start((const char*)object), _size(size)
+{
+  if(exclusionCount < MAX_SNAPSHOT_EXCLUSIONS) exclusions[exclusionCount++] = this;
+  else std::cerr << "Error: too many SnapshotExclusions" << std::endl;
+}
+
+#ifdef COPY_RELOCATION
+// Objects of a shared library's that the executable refers to directly, such as std::cout
+// and stdout, are copied into the executable's .bss by "copy relocations".  They are the
+// library's state, not the simulation's, so they are left out.
+static void excludeCopyRelocations(const ElfW(Dyn)* dynamic, ElfW(Addr) base) {
+  const ElfW(Sym)* symbols = NULL;
+  const Relocation* relocations = NULL;
+  size_t size = 0;
+  for(; dynamic->d_tag != DT_NULL; dynamic++) {
+    // glibc relocates these addresses in place; other loaders may not
+    ElfW(Addr) address = dynamic->d_un.d_ptr < base ? dynamic->d_un.d_ptr + base : dynamic->d_un.d_ptr;
+    if(dynamic->d_tag == DT_SYMTAB) symbols = (const ElfW(Sym)*) address;
+    else if(dynamic->d_tag == DT_RELOCATIONS) relocations = (const Relocation*) address;
+    else if(dynamic->d_tag == DT_RELOCATIONS_SIZE) size = dynamic->d_un.d_val;
+  }
+  if(!symbols || !relocations) return;
+  for(size_t i = 0; i < size / sizeof(Relocation); i++) {
+    if(RELOCATION_TYPE(relocations[i].r_info) != COPY_RELOCATION) continue;
+    uintptr_t start = base + relocations[i].r_offset;
+    excluded.push_back({start, start + symbols[RELOCATION_SYMBOL(relocations[i].r_info)].st_size});
+  }
+}
+#endif
+
+static int findDataSegments(struct dl_phdr_info* info, size_t size, void* data) {
+  std::vector<Range> &segments = *(std::vector<Range>*) data;
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  for(unsigned i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &header = info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + header.p_vaddr;
+    if(header.p_type == PT_LOAD && (header.p_flags & PF_W)) {
+      segments.push_back({start, start + header.p_memsz});
+    } else if(header.p_type == PT_GNU_RELRO) {
+      // Made read-only (a whole page at a time) once the dynamic linker is done with it
+      excluded.push_back({start & ~(page - 1), (start + header.p_memsz) & ~(page - 1)});
+    } else if(header.p_type == PT_DYNAMIC) {
+#ifdef COPY_RELOCATION
+      excludeCopyRelocations((const ElfW(Dyn)*) start, info->dlpi_addr);
+#endif
+    }
+  }
+  return 1;  // the executable always comes first, and is all that's wanted
+}
+
+static bool startsFirst(const Range &a, const Range &b) { return a.start < b.start; }
+
+static bool findPieces(void) {
+  std::vector<Range> segments;
+  dl_iterate_phdr(findDataSegments, &segments);
+  for(unsigned i = 0; i < exclusionCount; i++) {
+    uintptr_t start = (uintptr_t) exclusions[i]->start();
+    excluded.push_back({start, start + exclusions[i]->size()});
+  }
+  std::sort(excluded.begin(), excluded.end(), startsFirst);
+
+  size_t total = 0;
+  for(size_t i = 0; i < segments.size(); i++) {
+    uintptr_t pos = segments[i].start;
+    for(size_t j = 0; j < excluded.size() && excluded[j].start < segments[i].end; j++) {
+      if(excluded[j].end <= pos) continue;
+      if(excluded[j].start > pos) pieces.push_back({pos, excluded[j].start});
+      pos = excluded[j].end;
+    }
+    if(pos < segments[i].end) pieces.push_back({pos, segments[i].end});
+  }
+  for(size_t i = 0; i < pieces.size(); i++) total += pieces[i].end - pieces[i].start;
+  if(!total) {
+    std::cerr << "Error: can't find the data segments to snapshot" << std::endl;
+    return false;
+  }
+  arena.resize(total);
+  return true;
+}
+
+bool snapshot(void) {
+#ifdef VIRTUAL_THREADS
+  std::cerr << "Error: snapshots can't be used with more than one simulation at once" << std::endl;
+  return false;
+#endif
+  if(isInteractive() || isAsyncOutput() || isVerifySparseScan()) {
+    std::cerr << "Error: snapshots can't be used with "
+      << (isInteractive() ? "-i" : isAsyncOutput() ? "--async-output" : "--verify-sparse-scan") << std::endl;
+    return false;
+  }
+  if(pieces.empty() && !findPieces()) return false;
+  // Set before the copy, so that restoring it leaves it set
+  haveSnapshot = true;
+  for(unsigned i = 0; i < exclusionCount; i++) exclusions[i]->save();
+  char* to = &arena[0];
+  for(size_t i = 0; i < pieces.size(); i++) {
+    size_t size = pieces[i].end - pieces[i].start;
+    memcpy(to, (const void*) pieces[i].start, size);
+    to += size;
+  }
+  return true;
+}
+
+bool restore(void) {
+  if(!haveSnapshot) return false;
+  const char* from = &arena[0];
+  for(size_t i = 0; i < pieces.size(); i++) {
+    size_t size = pieces[i].end - pieces[i].start;
+    memcpy((void*) pieces[i].start, from, size);
+    from += size;
+  }
+  for(unsigned i = 0; i < exclusionCount; i++) exclusions[i]->restore();
+  return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+
+// Checkpoints of the whole simulation.  A sketch keeps nearly all of its state in static
+// storage, as do Kaleidoscope and its plugins, and so does the virtual core: the virtual
+// clock and the rest of the main VirtualContext, the matrix state behind KeyboardHardware,
+// and the last report of each HID interface.  snapshot() copies the executable's writable
+// data segments (.data and .bss, found through dl_iterate_phdr()) into an arena that is
+// allocated once and reused, and restore() copies them back, which takes the simulation back
+// to exactly where it was, a few microseconds and a memcpy() later.  That is what lets one
+// long prefix of a script (a layer setup, say) be run once, and any number of suffixes be
+// run on from the end of it (--suffixes).
+//
+// What isn't in the executable's data segments isn't in a snapshot:
+//   - The heap.  A static object that keeps its state on the heap (a std::vector, a
+//     std::string) must be declared to snapshots with a SnapshotCopy, below; copying its
+//     bytes alone would leave it pointing at memory that may since have been freed.
+//   - Shared libraries, such as libc's and libstdc++'s state (stdio, std::cout, the
+//     heap's own bookkeeping), even the objects of theirs the executable has a copy of.
+//   - Output.  Files go on from wherever they have got to, and must stay open (and not be
+//     reopened) from the snapshot until its restore().
+// There is one snapshot at a time; another replaces it.  Snapshots are of the whole
+// program, so they can't be used with VIRTUAL_THREADS, interactive input, --async-output
+// or --verify-sparse-scan.
+bool snapshot(void);  // Returns TRUE if successful, FALSE if not
+bool restore(void);  // Returns FALSE if there is no snapshot
+
+// Memory that restore() leaves alone.  Constructed as a static object at file scope (so
+// before the first snapshot), with the static object it covers.
+class SnapshotExclusion {
+  public:
+    SnapshotExclusion(const void* object, size_t size);
+    virtual void save(void) {}  // called by snapshot()
+    virtual void restore(void) {}  // called by restore(), once the data segments are back
+
+    const char* start(void) const { return _start; }
+    size_t size(void) const { return _size; }
+
+  private:
+    const char* _start;
+    size_t _size;
+};
+
+// A static object with state on the heap, which is kept in snapshots as a copy made with
+// its operator=, and assigned back to it by restore().  Arrays of such objects are copied
+// an element at a time.
+template <typename T>
+class SnapshotCopy : public SnapshotExclusion {
+  public:
+    SnapshotCopy(T &object)
+      :  SnapshotExclusion(&object, sizeof(T)), _object(object), _saved(new Saved)
+    {
+    }
+    virtual void save(void) override { copy(_saved->value, _object); }
+    virtual void restore(void) override { copy(_object, _saved->value); }
+
+  private:
+    struct Saved {
+      T value;
+    };
+    T &_object;
+    Saved* _saved;  // on the heap, so that the pointer never changes
+
+    template <typename U> static void copy(U &to, const U &from) { to = from; }
+    template <typename U, size_t n> static void copy(U (&to)[n], const U (&from)[n]) {
+      for(size_t i = 0; i < n; i++) copy(to[i], from[i]);
+    }
+};
@@ -0,0 +1,167 @@
+#include "usb_log.h"
+#include "async_output.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <stdio.h>  // fopen(), fwrite()
+#include <fcntl.h>  // open()
+
+#define MAX_USB_INTERFACES 128
+#define KEYBOARD_INTERFACE "Keyboard HID report"
+
+static SIMULATION_LOCAL FILE* binaryLog = NULL;
+static SIMULATION_LOCAL unsigned lastCycle = 0;
+
+// Interfaces, by id, with the last report each one sent
+static SIMULATION_LOCAL std::string interfaceNames[MAX_USB_INTERFACES];
+static SIMULATION_LOCAL std::vector<uint8_t> lastReports[MAX_USB_INTERFACES];
+static SIMULATION_LOCAL unsigned interfaceCount = 0;
+static SnapshotCopy<std::string[MAX_USB_INTERFACES]> interfaceNamesInSnapshots(interfaceNames);
+static SnapshotCopy<std::vector<uint8_t>[MAX_USB_INTERFACES]> lastReportsInSnapshots(lastReports);
+
+bool openBinaryUSBLog(const char* filename) {
+  if(isAsyncOutput()) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    binaryLog = fd < 0 ? NULL : openAsyncFile(fd);
+  } else {
+    binaryLog = fopen(filename, "wb");
+  }
+  if(!binaryLog) {
+    std::cerr << "Error opening USB log \"" << filename << "\"" << std::endl;
+    return false;
+  }
+  // Records are small and frequent, so they go out in large blocks; the buffer is
+  // flushed when the program exits
+  setvbuf(binaryLog, NULL, _IOFBF, 1 << 20);
+  UsbLogHeader header;
+  memcpy(header.magic, USB_LOG_MAGIC, 4);
+  header.version = USB_LOG_VERSION;
+  memset(header.reserved, 0, sizeof(header.reserved));
+  fwrite(&header, sizeof(header), 1, binaryLog);
+  return true;
+}
+
+void closeBinaryUSBLog(void) {
+  if(!binaryLog) return;
+  fclose(binaryLog);
+  binaryLog = NULL;
+}
+
+FILE* binaryUSBLogFile(void) { return binaryLog; }
+
+static void putRecord(unsigned cycle, uint8_t id, const uint8_t* body, uint8_t length) {
+  uint8_t record[5 + 2 + 255];
+  size_t size = 0;
+  unsigned delta = cycle - lastCycle;
+  lastCycle = cycle;
+  while(delta >= 0x80) {
+    record[size++] = (delta & 0x7f) | 0x80;
+    delta >>= 7;
+  }
+  record[size++] = delta;
+  record[size++] = id;
+  record[size++] = length;
+  memcpy(record + size, body, length);
+  fwrite(record, 1, size + length, binaryLog);
+}
+
+void putBinaryUSBLog(unsigned cycle, const std::string &interface, const void* data, size_t length) {
+  if(!binaryLog) return;
+  if(length > 255) {
+    std::cerr << "Error: " << interface << " of " << length << " bytes is too long for the USB log" << std::endl;
+    return;
+  }
+  unsigned id = 0;
+  while(id < interfaceCount && interfaceNames[id] != interface) id++;
+  if(id == interfaceCount) {
+    if(id == MAX_USB_INTERFACES || interface.length() > 255) {
+      std::cerr << "Error: can't add \"" << interface << "\" to the USB log" << std::endl;
+      return;
+    }
+    interfaceNames[interfaceCount++] = interface;
+    putRecord(cycle, 0x80 | id, (const uint8_t*)interface.data(), interface.length());
+  }
+
+  std::vector<uint8_t> &last = lastReports[id];
+  last.resize(length, 0);
+  uint8_t delta[255];
+  const uint8_t* report = (const uint8_t*)data;
+  for(size_t i = 0; i < length; i++) {
+    delta[i] = report[i] ^ last[i];
+    last[i] = report[i];
+  }
+  putRecord(cycle, id, delta, length);
+}
+
+bool decodeBinaryUSBLog(const char* filename) {
+  FILE* in = fopen(filename, "rb");
+  if(!in) {
+    std::cerr << "Error opening USB log \"" << filename << "\"" << std::endl;
+    return false;
+  }
+  std::vector<uint8_t> log;
+  uint8_t block[1 << 16];
+  size_t got;
+  while((got = fread(block, 1, sizeof(block), in)) > 0) log.insert(log.end(), block, block + got);
+  fclose(in);
+
+  UsbLogHeader header;
+  if(log.size() < sizeof(header) || memcmp(&log[0], USB_LOG_MAGIC, 4) != 0) {
+    std::cerr << "Error: \"" << filename << "\" is not a binary USB log" << std::endl;
+    return false;
+  }
+  memcpy(&header, &log[0], sizeof(header));
+  if(header.version != USB_LOG_VERSION) {
+    std::cerr << "Error: unsupported USB log version " << (unsigned)header.version << std::endl;
+    return false;
+  }
+
+  static const char hexDigits[] = "0123456789abcdef";
+  std::string line;
+  unsigned cycle = 0;
+  size_t pos = sizeof(header);
+  while(pos < log.size()) {
+    unsigned delta = 0;
+    for(unsigned shift = 0; pos < log.size(); shift += 7) {
+      uint8_t byte = log[pos++];
+      delta |= (unsigned)(byte & 0x7f) << shift;
+      if(!(byte & 0x80)) break;
+    }
+    cycle += delta;
+    if(log.size() - pos < 2 || log.size() - pos - 2 < log[pos + 1]) {
+      std::cerr << "Error: USB log is truncated" << std::endl;
+      return false;
+    }
+    uint8_t id = log[pos] & 0x7f;
+    bool introduction = log[pos] & 0x80;
+    size_t length = log[pos + 1];
+    const uint8_t* body = log.data() + pos + 2;  // not &log[...], which may be one past the end
+    pos += 2 + length;
+
+    if(introduction) {
+      interfaceNames[id].assign((const char*)body, length);
+      lastReports[id].clear();
+      continue;
+    }
+    std::vector<uint8_t> &last = lastReports[id];
+    last.resize(length, 0);
+    for(size_t i = 0; i < length; i++) last[i] ^= body[i];
+
+    line = "Cycle " + std::to_string(cycle) + ": " + interfaceNames[id];
+    if(interfaceNames[id] == KEYBOARD_INTERFACE) {
+      line += "; pressed keys: ";
+      appendKeyboardReport(line, last.data(), length);  // an empty report has no last[0]
+    } else {
+      line += ": 0x";
+      for(size_t i = 0; i < length; i++) {
+        line += hexDigits[last[i] >> 4];
+        line += hexDigits[last[i] & 0xf];
+      }
+    }
+    line += '\n';
+    std::cout << line;
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+
+// Binary USB logs (--usb-log=binary).  These hold the same reports as the text log,
+// results/USB.txt, in a fraction of the space and time.  The file starts with a
+// UsbLogHeader, followed by records of:
+//   - the number of cycles since the previous record, as a varint (7 bits per byte,
+//     least significant first, high bit set on all but the last byte)
+//   - a one-byte interface id
+//   - a one-byte length, then that many bytes of report
+// An interface is introduced by a record with the high bit of its id set, whose body is
+// the interface's name (the 'descrip' given to logUSBEvent()).  Every other record's
+// body is XORed with the previous report from the same interface (zero-padded to the
+// same length), so that unchanged bytes are zero.
+#define USB_LOG_MAGIC "KVUL"
+#define USB_LOG_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint8_t version;
+  uint8_t reserved[3];
+} UsbLogHeader;
+
+bool openBinaryUSBLog(const char* filename);  // Returns TRUE if successful, FALSE if not
+void closeBinaryUSBLog(void);
+FILE* binaryUSBLogFile(void);  // NULL if it isn't open
+void putBinaryUSBLog(unsigned cycle, const std::string &interface, const void* data, size_t length);
+
+// Prints a binary USB log to stdout in the text log's format.  Returns FALSE on error.
+bool decodeBinaryUSBLog(const char* filename);
+
+// Appends the keyboard's log text for a raw keyboard report (the "pressed keys") to 'out'.
+// The keyboard report format belongs to VirtualHID, so this is implemented there.
+void appendKeyboardReport(std::string &out, const void* data, size_t length);
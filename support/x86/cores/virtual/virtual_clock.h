@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The virtual clock, in microseconds since the start of the program.  It has nothing to
+// do with real time: it advances by the scan period at the end of every scan cycle, and
+// by exactly the requested amount in delay() and delayMicroseconds(), so every run of a
+// script sees the same times no matter how often the firmware reads the clock.
+uint64_t virtualMicros(void);
+void advanceVirtualClock(uint64_t micros);
+
+#ifdef __cplusplus
+}
+#endif
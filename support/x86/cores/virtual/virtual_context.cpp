@@ -0,0 +1,29 @@
+#include "virtual_context.h"
+#include "simulation.h"
+
+#define MAX_SIMULATION_END_HOOKS 16
+
+// The main thread's simulation.  Being plain data, it is all zeros before any constructor
+// runs, and is never destroyed, so it can be used at any point of startup or exit.
+static VirtualContext mainContext;
+
+thread_local VirtualContext* virtualContext = &mainContext;
+
+// Filled in by static constructors, so the same for every thread once main() starts
+static SimulationEndHook endHooks[MAX_SIMULATION_END_HOOKS];
+static unsigned endHookCount = 0;
+
+AtSimulationEnd::AtSimulationEnd(SimulationEndHook hook)
+  :  _hook(hook)
+{
+  if(endHookCount < MAX_SIMULATION_END_HOOKS) endHooks[endHookCount++] = hook;
+}
+
+// The main thread's simulation ends with the program
+AtSimulationEnd::~AtSimulationEnd() {
+  if(mainContext.started) _hook();
+}
+
+void runSimulationEndHooks(void) {
+  for(unsigned i = endHookCount; i--; ) endHooks[i]();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "virtual_io.h"
+#include <setjmp.h>
+#include <istream>
+#include <ostream>
+
+#define MAX_REPORT_KINDS 8
+#define MAX_RESULTS_FILES 16
+
+// The virtual core's state for one simulation (see simulation.h): its script, its clock
+// and cycle count, and its output.  The options aren't part of it; they are set once, from
+// the command line, and shared by every simulation.  It is plain data, and all zeros is a
+// simulation that hasn't started yet, so a new one is just "new VirtualContext()".
+struct VirtualContext {
+  bool started;  // TRUE once startScript() has been called
+
+  // The script.  Script files are mapped into memory whole, and lines are handed out as
+  // slices of the mapping, so reading a line never copies or allocates.
+  bool interactive;
+  std::istream* input;
+  const char* script;
+  bool scriptOnHeap;  // TRUE if the script was read from a pipe, not mapped
+  const char* scriptPos;
+  const char* scriptEnd;
+
+  // Binary matrix-frame input (frames are read in place from the mapped script)
+  bool frameInput;
+  MatrixFrameHeader frameInputHeader;
+  const uint64_t* frames;
+  size_t frameWords;  // per frame: 'held', 'tap', then a word holding 'repeat'
+  size_t frameCount;
+  size_t frameIndex;
+  uint32_t frameRepeatsLeft;
+
+  unsigned cycle;
+  unsigned idleCycles;
+  uint64_t clock;  // in microseconds (see virtual_clock.h)
+
+  // Quiescence skipping
+  IdleSkipPolicy idleSkipPolicy;
+  unsigned cyclesToSkip;
+  unsigned lastReportChangeCycle;
+  unsigned reportKindCount;
+  uint32_t reportKinds[MAX_REPORT_KINDS];  // hash of each kind's description
+  uint32_t lastReports[MAX_REPORT_KINDS];  // hash of the last report of each kind
+
+  char resultsDirectory[1024];  // empty for "results"
+  // Every results file opened so far, by name, for reopenResultsFiles()
+  FILE* resultsFiles[MAX_RESULTS_FILES];
+  char resultsFileNames[MAX_RESULTS_FILES][32];
+  unsigned resultsFileCount;
+  std::ostream* usbstream;
+
+  EndOfScriptHook endOfScriptHook;
+  jmp_buf* end;  // where endSimulation() goes, under runSimulation(); NULL to exit
+};
+
+// The simulation running on this thread.  For the main thread, and for any other until it
+// sets its own, that is the program's one simulation.
+extern thread_local VirtualContext* virtualContext;
+
+// At the end of a simulation under runSimulation(): runs the AtSimulationEnd hooks
+void runSimulationEndHooks(void);
+// Then closes the script and everything startScript() and openResultsFile() opened
+void closeScript(void);
@@ -1,86 +1,974 @@
 #include "virtual_io.h"
+#include "virtual_context.h"
+#include "simulation.h"
+#include "virtual_clock.h"
+#include "physical_keys.h"
+#include "usb_log.h"
+#include "async_output.h"
+#include "script_runner.h"
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <vector>
 #include <string.h>
-#include <stdlib.h>  // exit()
+#include <stdio.h>  // fopen(), fwrite()
+#include <stdlib.h>  // exit(), malloc()
 #include <sys/types.h>  // mkdir()
-#include <sys/stat.h>  // mkdir()
+#include <sys/stat.h>  // mkdir(), fstat()
+#include <sys/mman.h>  // mmap()
+#include <fcntl.h>  // open()
+#include <unistd.h>  // close(), fork(), pipe()
+#include <sys/wait.h>  // waitpid()
 #include <errno.h>
 
-static bool interactive;
-static std::istream* input = NULL;
-static std::ostream* usbstream = NULL;
-static unsigned cycle = 0;
+static bool binaryUSBLog = false;  // results/USB.bin instead of results/USB.txt
+static bool lazyReports = false;  // keyboard reports are only rendered as text at exit
+static bool asyncOutput = false;  // stdout and the results files are written by a writer thread
+uint8_t virtualVerbosity = VERBOSITY_CYCLES;  // HID reports and the start of each cycle go to stdout
+static unsigned long scanPeriod = 1000;  // microseconds
+static bool eventInput = false;
+static unsigned jobs = 0;  // parallel workers for -r; 0 means one per core
+static bool forkServer = false;
+static const char* suffixes = NULL;  // --suffixes: a script, or a directory of them
+static const char* minimize = NULL;  // --minimize: the failure to keep, "expect" or "crash"
 
-bool isInteractive(void) { return interactive; }
+// The USB host model
+static unsigned long hostPoll = 0;  // microseconds; 0 means no host model
+static unsigned hostQueue = 1;
+static bool hostDrop = false;
 
-unsigned currentCycle(void) { return cycle; }
-void nextCycle(void) { cycle++; }
+static bool latencyAnalysis = false;
+static bool mouseTrajectory = false;
 
-void logUSBEvent(std::string descrip, void* data, int length) {
-  if(usbstream) {
+// Quiescence skipping
+static unsigned skipIdleAfter = 0;  // 0 means never skip
+
+// Sparse scan verification: a forked reference process runs the same script with full
+// scans, and sends each of its HID reports down a pipe to be compared with ours
+static bool sparseScan = false;
+static bool verifySparseScan = false;
+static bool isReference = false;
+static pid_t reference = 0;
+static int referencePipe = -1;  // the write end in the reference process, the read end in ours
+
+// Matrix-frame output, for -c
+static FILE* frameOutput = NULL;
+static std::vector<uint64_t> pendingFrame;
+
+bool isInteractive(void) { return virtualContext->interactive; }
+
+bool isEndOfInput(void) {
+  const VirtualContext &context = *virtualContext;
+  if(context.interactive || context.idleCycles) return false;
+  if(context.frameInput) return context.frameRepeatsLeft == 0 && context.frameIndex == context.frameCount;
+  return context.scriptPos == context.scriptEnd;
+}
+
+unsigned currentCycle(void) { return virtualContext->cycle; }
+void nextCycle(void) {
+  VirtualContext &context = *virtualContext;
+  context.cycle += 1 + context.cyclesToSkip;
+  advanceVirtualClock((uint64_t)context.cyclesToSkip * scanPeriod);
+  context.cyclesToSkip = 0;
+}
+
+void addIdleCycles(unsigned cycles) { virtualContext->idleCycles += cycles; }
+bool isIdleCycle(void) { return virtualContext->idleCycles > 0; }
+bool takeIdleCycle(void) {
+  VirtualContext &context = *virtualContext;
+  if(!context.idleCycles) return false;
+  context.idleCycles--;
+  return true;
+}
+
+static uint32_t hashBytes(const void* data, size_t length) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for(size_t i = 0; i < length; i++) hash = (hash ^ ((const uint8_t*)data)[i]) * 16777619u;
+  return hash;
+}
+
+// Only reports that differ from the previous report of the same kind count as activity
+static void noteReport(const std::string &kind, const void* data, size_t length) {
+  if(!skipIdleAfter) return;
+  VirtualContext &context = *virtualContext;
+  uint32_t kindHash = hashBytes(kind.data(), kind.length());
+  uint32_t reportHash = hashBytes(data, length);
+  for(unsigned i = 0; i < context.reportKindCount; i++) {
+    if(context.reportKinds[i] == kindHash) {
+      if(context.lastReports[i] != reportHash) context.lastReportChangeCycle = context.cycle;
+      context.lastReports[i] = reportHash;
+      return;
+    }
+  }
+  if(context.reportKindCount < MAX_REPORT_KINDS) {
+    context.reportKinds[context.reportKindCount] = kindHash;
+    context.lastReports[context.reportKindCount++] = reportHash;
+  }
+  context.lastReportChangeCycle = context.cycle;
+}
+
+void setIdleSkipPolicy(IdleSkipPolicy policy) { virtualContext->idleSkipPolicy = policy; }
+
+bool canSkipIdleCycles(void) {
+  const VirtualContext &context = *virtualContext;
+  return skipIdleAfter && context.cycle - context.lastReportChangeCycle >= skipIdleAfter
+    && (!context.idleSkipPolicy || context.idleSkipPolicy());
+}
+
+void skipIdleCycles(unsigned cycles) { virtualContext->cyclesToSkip = cycles; }
+
+void skipRestOfIdleCycles(void) {
+  skipIdleCycles(virtualContext->idleCycles);
+  virtualContext->idleCycles = 0;
+}
+
+bool isSparseScan(void) { return sparseScan; }
+
+static bool readFully(int fd, void* buf, size_t length) {
+  while(length) {
+    ssize_t got = read(fd, buf, length);
+    if(got <= 0) return false;
+    buf = (char*)buf + got;
+    length -= got;
+  }
+  return true;
+}
+
+static void writeFully(int fd, const void* buf, size_t length) {
+  while(length) {
+    ssize_t put = write(fd, buf, length);
+    if(put <= 0) exit(1);  // the checked process has gone away
+    buf = (const char*)buf + put;
+    length -= put;
+  }
+}
+
+static void printReport(std::ostream& os, uint32_t reportCycle, const std::string &descrip, const std::string &data) {
+  os << "cycle " << std::dec << reportCycle << ": " << descrip;
+  if(descrip == "Keyboard HID report") {
+    std::string keypresses;
+    appendKeyboardReport(keypresses, data.data(), data.length());
+    os << "; pressed keys: " << keypresses;
+  } else if(data.length()) {
+    os << ": 0x" << std::hex;
+    for(size_t i = 0; i < data.length(); i++) os << std::setfill('0') << std::setw(2) << (unsigned int)(uint8_t)data[i];
+    os << std::dec;
+  }
+}
+
+// Reads the reference process's next report; returns FALSE if it has no more
+static bool readReferenceReport(uint32_t &reportCycle, std::string &descrip, std::string &data) {
+  uint32_t header[3];
+  if(!readFully(referencePipe, header, sizeof(header))) return false;
+  reportCycle = header[0];
+  descrip.resize(header[1]);
+  data.resize(header[2]);
+  return readFully(referencePipe, &descrip[0], header[1]) && readFully(referencePipe, &data[0], header[2]);
+}
+
+static void checkReport(const std::string &descrip, const void* data, size_t length) {
+  if(referencePipe < 0) return;
+  if(isReference) {
+    uint32_t header[3] = { currentCycle(), (uint32_t)descrip.length(), (uint32_t)length };
+    writeFully(referencePipe, header, sizeof(header));
+    writeFully(referencePipe, descrip.data(), descrip.length());
+    writeFully(referencePipe, data, length);
+    return;
+  }
+  static std::string refDescrip, refData;
+  uint32_t refCycle;
+  bool sent = readReferenceReport(refCycle, refDescrip, refData);
+  if(!sent || refCycle != currentCycle() || refDescrip != descrip
+      || refData.length() != length || memcmp(refData.data(), data, length)) {
+    std::cerr << "Sparse scan mismatch!\n  sparse scan sent: ";
+    printReport(std::cerr, currentCycle(), descrip, std::string((const char*)data, length));
+    std::cerr << "\n  full scan sent:   ";
+    if(sent) printReport(std::cerr, refCycle, refDescrip, refData);
+    else std::cerr << "nothing more";
+    std::cerr << std::endl;
+    close(referencePipe);  // the reference process dies of SIGPIPE
+    referencePipe = -1;
+    exit(1);
+  }
+}
+
+// At exit, the reference process must not have any reports left over
+static struct ReferenceCheck {
+  ~ReferenceCheck() {
+    if(referencePipe < 0 || isReference) return;
+    uint32_t refCycle;
+    std::string refDescrip, refData;
+    if(readReferenceReport(refCycle, refDescrip, refData)) {
+      std::cerr << "Sparse scan mismatch!\n  sparse scan sent: nothing more\n  full scan sent:   ";
+      printReport(std::cerr, refCycle, refDescrip, refData);
+      std::cerr << std::endl;
+      _exit(1);
+    }
+    waitpid(reference, NULL, 0);
+  }
+} referenceCheck;
+
+// Starts the reference process for --verify-sparse-scan
+static bool startReference(void) {
+  int fds[2];
+  if(pipe(fds)) {
+    std::cerr << "Error creating pipe, errno " << errno << std::endl;
+    return false;
+  }
+  reference = fork();
+  if(reference < 0) {
+    std::cerr << "Error forking reference process, errno " << errno << std::endl;
+    return false;
+  }
+  if(reference == 0) {
+    // The reference process does full scans, and its only output is its reports
+    isReference = true;
+    sparseScan = false;
+    referencePipe = fds[1];
+    close(fds[0]);
+    if(!freopen("/dev/null", "w", stdout)) return false;
+  } else {
+    referencePipe = fds[0];
+    close(fds[1]);
+  }
+  return true;
+}
+
+static const char* resultsDirectory(void) {
+  const char* directory = virtualContext->resultsDirectory;
+  return directory[0] ? directory : "results";
+}
+
+void setResultsDirectory(const char* directory) {
+  snprintf(virtualContext->resultsDirectory, sizeof(virtualContext->resultsDirectory), "%s", directory);
+}
+
+FILE* openResultsFile(const char* name) {
+  if(isReference) return fopen("/dev/null", "w");
+  std::string path = std::string(resultsDirectory()) + "/" + name;
+  FILE* file;
+  if(isAsyncOutput()) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    file = fd < 0 ? NULL : openAsyncFile(fd);
+  } else {
+    file = fopen(path.c_str(), "w");
+  }
+  VirtualContext &context = *virtualContext;
+  if(file && context.resultsFileCount < MAX_RESULTS_FILES) {
+    snprintf(context.resultsFileNames[context.resultsFileCount], sizeof(context.resultsFileNames[0]), "%s", name);
+    context.resultsFiles[context.resultsFileCount++] = file;
+  }
+  return file;
+}
+
+void closeResultsFile(FILE* file) {
+  VirtualContext &context = *virtualContext;
+  for(unsigned i = 0; i < context.resultsFileCount; i++) {
+    if(context.resultsFiles[i] != file) continue;
+    context.resultsFileCount--;
+    for(; i < context.resultsFileCount; i++) {
+      context.resultsFiles[i] = context.resultsFiles[i + 1];
+      memcpy(context.resultsFileNames[i], context.resultsFileNames[i + 1], sizeof(context.resultsFileNames[i]));
+    }
+    break;
+  }
+  fclose(file);
+}
+
+// Copies 'from' to 'to': all of it, or with a 'length', only its first 'length' bytes
+static bool copyFile(const std::string &from, const std::string &to, long length = -1) {
+  FILE* in = fopen(from.c_str(), "rb");
+  FILE* out = in ? fopen(to.c_str(), "wb") : NULL;
+  char block[1 << 16];
+  size_t got;
+  while(out && length && (got = fread(block, 1, length < 0 || length > (long)sizeof(block) ? sizeof(block) : length, in)) > 0) {
+    fwrite(block, 1, got, out);
+    if(length > 0) length -= got;
+  }
+  bool ok = in && out && !ferror(in) && !ferror(out);
+  if(in) fclose(in);
+  if(out && fclose(out)) ok = false;
+  if(!ok) std::cerr << "Error copying '" << from << "' to '" << to << "', errno " << errno << std::endl;
+  return ok;
+}
+
+static bool sameFile(const std::string &a, const std::string &b) {
+  struct stat infoA, infoB;
+  return stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0
+    && infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+bool reopenResultsFiles(const char* directory) {
+  const VirtualContext &context = *virtualContext;
+  std::string from = resultsDirectory(), to = directory;
+  for(unsigned i = 0; i < context.resultsFileCount; i++) {
+    FILE* file = context.resultsFiles[i];
+    std::string fromPath = from + "/" + context.resultsFileNames[i], toPath = to + "/" + context.resultsFileNames[i];
+    // The parent has flushed everything it wrote, so this is where it is up to.  Anything
+    // after that in the file is from other children, and is left out of this one's copy.
+    fflush(file);
+    long length = ftell(file);
+    // In the parent's own directory, the file is appended to as it is, never truncated
+    if(!sameFile(fromPath, toPath) && !copyFile(fromPath, toPath, length < 0 ? 0 : length)) return false;
+    if(!freopen(toPath.c_str(), "a", file)) {
+      std::cerr << "Error reopening '" << toPath << "', errno " << errno << std::endl;
+      return false;
+    }
+  }
+  setResultsDirectory(directory);
+  return true;
+}
+
+// Copies 'from' to 'to', then reopens 'file', which has been writing to 'from', to append to 'to'
+static bool moveResultsFile(FILE* file, const std::string &from, const std::string &to) {
+  fflush(file);
+  if(!copyFile(from, to)) return false;
+  if(!freopen(to.c_str(), "a", file)) {
+    std::cerr << "Error reopening '" << to << "', errno " << errno << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool moveResultsFiles(const char* directory) {
+  VirtualContext &context = *virtualContext;
+  std::string from = resultsDirectory(), to = directory;
+  for(unsigned i = 0; i < context.resultsFileCount; i++) {
+    const char* name = context.resultsFileNames[i];
+    if(!moveResultsFile(context.resultsFiles[i], from + "/" + name, to + "/" + name)) return false;
+  }
+  if(binaryUSBLog) {
+    FILE* log = binaryUSBLogFile();
+    if(log && !moveResultsFile(log, from + "/USB.bin", to + "/USB.bin")) return false;
+  } else if(context.usbstream) {
+    // Without --async-output, which snapshots refuse, the text log is always a file stream
+    std::ofstream &log = *static_cast<std::ofstream*>(context.usbstream);
+    log.close();
+    if(!copyFile(from + "/USB.txt", to + "/USB.txt")) return false;
+    log.open(to + "/USB.txt", std::ios::app);
+    if(!log.is_open()) {
+      std::cerr << "Error reopening '" << to << "/USB.txt'" << std::endl;
+      return false;
+    }
+  }
+  setResultsDirectory(directory);
+  return true;
+}
+
+// The text log is only flushed per report in interactive mode, where someone may be
+// watching it; otherwise the flushes would cost more than the writes
+static void endUSBLogLine(std::ostream &usbstream) {
+  if(virtualContext->interactive) usbstream << std::endl;
+  else usbstream << '\n';
+}
+
+void logUSBEvent(const std::string &descrip, const void* data, int length) {
+  noteReport(descrip, data, length);
+  checkReport(descrip, data, length);
+  std::ostream* usbstream = virtualContext->usbstream;
+  if(binaryUSBLog) {
+    putBinaryUSBLog(currentCycle(), descrip, data, length);
+  } else if(usbstream) {
     *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << ": 0x" << std::hex;
-    unsigned char* report = (unsigned char*) data;
+    const unsigned char* report = (const unsigned char*) data;
     for(int i = 0; i < length; i++) *usbstream << std::setfill('0') << std::setw(2) << (unsigned int)(report[i]);  // pad with 0's to total of 2 characters
-    *usbstream << std::endl;
+    endUSBLogLine(*usbstream);
   }
 }
 
-void logUSBEvent_keyboard(std::string descrip) {
-  if(usbstream) {
-    *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << std::endl;
+// At file scope, so that it is constructed before any simulation thread starts
+static const std::string keyboardDescrip("Keyboard HID report");
+
+void logUSBEvent_keyboard(const std::string &descrip, const void* data, int length) {
+  noteReport(keyboardDescrip, data, length);
+  checkReport(keyboardDescrip, data, length);
+  std::ostream* usbstream = virtualContext->usbstream;
+  if(binaryUSBLog) {
+    putBinaryUSBLog(currentCycle(), keyboardDescrip, data, length);
+  } else if(usbstream && !lazyReports) {
+    *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip;
+    endUSBLogLine(*usbstream);
   }
 }
 
+void logDeferredUSBEvent_keyboard(unsigned reportCycle, const std::string &descrip) {
+  std::ostream* usbstream = virtualContext->usbstream;
+  if(binaryUSBLog || !usbstream) return;
+  *usbstream << "Cycle " << std::dec << reportCycle << ": " << descrip << '\n';
+}
+
+void flushUSBLog(void) {
+  if(virtualContext->usbstream) virtualContext->usbstream->flush();
+}
+
+// The text log's stream is never destroyed in the main simulation, so its buffer is
+// flushed here at the end
+static AtSimulationEnd usbLogFlush(flushUSBLog);
+
+bool isLazyReports(void) { return lazyReports; }
+bool isTextUSBLog(void) { return virtualContext->usbstream && !binaryUSBLog && !lazyReports; }
+
+// If 'arg' is the option 'name' (which ends in '='), returns its value, else NULL
+static const char* optionValue(const char* arg, const char* name) {
+  size_t length = strlen(name);
+  return strncmp(arg, name, length) == 0 ? arg + length : NULL;
+}
+
 bool initVirtualInput(int argc, char* argv[]) {
-  if(argc < 2 || strcmp(argv[1], "?") == 0) {
+  // Options come first, then the script (or -i)
+  int arg = 1;
+  for(; arg < argc && (strncmp(argv[arg], "--", 2) == 0 || strcmp(argv[arg], "-q") == 0); arg++) {
+    const char* value;
+    if(strcmp(argv[arg], "-q") == 0) {
+      virtualVerbosity = VERBOSITY_SILENT;
+    } else if((value = optionValue(argv[arg], "--verbosity="))) {
+      if(strlen(value) != 1 || value[0] < '0' + VERBOSITY_SILENT || value[0] > '0' + VERBOSITY_CYCLES) {
+        std::cerr << "Error: bad --verbosity \"" << value << "\" (expected 0, 1 or 2)" << std::endl;
+        return false;
+      }
+      virtualVerbosity = value[0] - '0';
+    } else if(strcmp(argv[arg], "--events") == 0) {
+      eventInput = true;
+    } else if(strcmp(argv[arg], "--async-output") == 0) {
+      asyncOutput = true;
+    } else if(strcmp(argv[arg], "--lazy-reports") == 0) {
+      lazyReports = true;
+    } else if(strcmp(argv[arg], "--sparse-scan") == 0) {
+      sparseScan = true;
+    } else if(strcmp(argv[arg], "--verify-sparse-scan") == 0) {
+      sparseScan = true;
+      verifySparseScan = true;
+    } else if((value = optionValue(argv[arg], "--usb-log="))) {
+      if(strcmp(value, "binary") == 0) binaryUSBLog = true;
+      else if(strcmp(value, "text") == 0) binaryUSBLog = false;
+      else {
+        std::cerr << "Error: bad --usb-log \"" << value << "\" (expected text or binary)" << std::endl;
+        return false;
+      }
+    } else if((value = optionValue(argv[arg], "--skip-idle="))) {
+      char* end;
+      skipIdleAfter = strtoul(value, &end, 10);
+      if(*end || skipIdleAfter == 0) {
+        std::cerr << "Error: bad --skip-idle \"" << value << "\" (expected a number of cycles)" << std::endl;
+        return false;
+      }
+    } else if((value = optionValue(argv[arg], "--jobs="))) {
+      char* end;
+      jobs = strtoul(value, &end, 10);
+      if(*end || jobs == 0) {
+        std::cerr << "Error: bad --jobs \"" << value << "\" (expected a number of workers)" << std::endl;
+        return false;
+      }
+    } else if(strcmp(argv[arg], "--fork-server") == 0) {
+      forkServer = true;
+    } else if((value = optionValue(argv[arg], "--suffixes="))) {
+      suffixes = value;
+    } else if(strcmp(argv[arg], "--minimize") == 0) {
+      minimize = "expect";
+    } else if((value = optionValue(argv[arg], "--minimize="))) {
+      if(strcmp(value, "expect") && strcmp(value, "crash")) {
+        std::cerr << "Error: bad --minimize \"" << value << "\" (expected expect or crash)" << std::endl;
+        return false;
+      }
+      minimize = value;
+    } else if(strcmp(argv[arg], "--latency") == 0) {
+      latencyAnalysis = true;
+    } else if(strcmp(argv[arg], "--mouse-trajectory") == 0) {
+      mouseTrajectory = true;
+    } else if((value = optionValue(argv[arg], "--host-poll="))) {
+      char* end;
+      hostPoll = strtoul(value, &end, 10);
+      if(*end || hostPoll == 0) {
+        std::cerr << "Error: bad --host-poll \"" << value << "\" (expected microseconds)" << std::endl;
+        return false;
+      }
+    } else if((value = optionValue(argv[arg], "--host-queue="))) {
+      char* end;
+      hostQueue = strtoul(value, &end, 10);
+      if(*end || hostQueue == 0 || hostQueue > MAX_HOST_QUEUE) {
+        std::cerr << "Error: bad --host-queue \"" << value << "\" (expected 1 to " << MAX_HOST_QUEUE << " reports)" << std::endl;
+        return false;
+      }
+    } else if((value = optionValue(argv[arg], "--host-overflow="))) {
+      if(strcmp(value, "drop") == 0) hostDrop = true;
+      else if(strcmp(value, "coalesce") == 0) hostDrop = false;
+      else {
+        std::cerr << "Error: bad --host-overflow \"" << value << "\" (expected coalesce or drop)" << std::endl;
+        return false;
+      }
+    } else if((value = optionValue(argv[arg], "--scan-period="))) {
+      char* end;
+      scanPeriod = strtoul(value, &end, 10);
+      if(*end || scanPeriod == 0) {
+        std::cerr << "Error: bad scan period \"" << value << "\" (expected microseconds)" << std::endl;
+        return false;
+      }
+    } else {
+      std::cerr << "Error: unrecognized option \"" << argv[arg] << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  if(suffixes) {
+    // The prefix and every suffix run in this process, one after another, from snapshots
+    const char* conflict = forkServer ? "--fork-server" : eventInput ? "--events" : asyncOutput ? "--async-output"
+      : verifySparseScan ? "--verify-sparse-scan" : arg < argc && strcmp(argv[arg], "-i") == 0 ? "-i"
+      : arg < argc && strcmp(argv[arg], "-r") == 0 ? "-r" : NULL;
+    if(conflict) {
+      std::cerr << "Error: --suffixes can't be used with " << conflict << std::endl;
+      return false;
+    }
+  }
+
+  if(minimize) {
+    // Each candidate runs in a child forked once setup() is done, as under --fork-server
+    const char* conflict = forkServer ? "--fork-server" : suffixes ? "--suffixes" : eventInput ? "--events"
+      : asyncOutput ? "--async-output" : NULL;
+    if(conflict) {
+      std::cerr << "Error: --minimize can't be used with " << conflict << std::endl;
+      return false;
+    }
+    if(argc - arg != 1 || argv[arg][0] == '-' || strcmp(argv[arg], "?") == 0) {
+      std::cerr << "Error: --minimize expects a single text script" << std::endl;
+      return false;
+    }
+    if(mkdir(resultsDirectory(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+      std::cerr << "Error creating directory '" << resultsDirectory() << "', errno " << errno << std::endl;
+      return false;
+    }
+    // The candidates are started by minimizeScript(), once setup() is done
+    return startMinimizer(argv[arg], strcmp(minimize, "crash") == 0);
+  }
+
+  if(forkServer) {
+    if(arg < argc) {
+      std::cerr << "Error: --fork-server takes its scripts on stdin, not as arguments" << std::endl;
+      return false;
+    }
+    if(mkdir(resultsDirectory(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+      std::cerr << "Error creating directory '" << resultsDirectory() << "', errno " << errno << std::endl;
+      return false;
+    }
+    // The scripts are started by runForkServer(), once setup() is done
+    return startForkServer();
+  }
+
+  if(arg >= argc || strcmp(argv[arg], "?") == 0) {
     printHelp();
     return false;
-  } else if(argc > 2) {
-    std::cerr << "Error: more arguments than expected (got " << argc-1 << ")" << std::endl;
+  }
+
+  if(strcmp(argv[arg], "-c") == 0) {
+    if(argc - arg != 3) {
+      std::cerr << "Error: -c expects an input text script and an output frame script" << std::endl;
+      return false;
+    }
+    exit(convertScript(argv[arg+1], argv[arg+2]) ? 0 : 1);
+  } else if(strcmp(argv[arg], "-d") == 0) {
+    if(argc - arg != 2) {
+      std::cerr << "Error: -d expects a binary USB log" << std::endl;
+      return false;
+    }
+    exit(decodeBinaryUSBLog(argv[arg+1]) ? 0 : 1);
+  }
+
+  const char* scriptName = argv[arg];
+  if(suffixes && !findSuffixes(suffixes)) return false;
+  if(strcmp(argv[arg], "-r") == 0) {
+    if(argc - arg < 2) {
+      std::cerr << "Error: -r expects scripts, or directories of scripts" << std::endl;
+      return false;
+    }
+    if(!jobs) {
+      long cores = sysconf(_SC_NPROCESSORS_ONLN);
+      jobs = cores > 0 ? cores : 1;
+    }
+    // Only returns in a worker, with the script it is to run
+    scriptName = runScripts(argc - arg - 1, argv + arg + 1, jobs);
+    if(!scriptName) return false;
+  } else if(argc - arg > 1) {
+    std::cerr << "Error: more arguments than expected (got " << argc-arg << ")" << std::endl;
     return false;
   }
 
-  if(strcmp(argv[1], "-i") == 0) {
-    interactive = true;
-    input = &std::cin;
+  return startScript(scriptName);
+}
+
+bool startScript(const char* scriptName) {
+  VirtualContext &context = *virtualContext;
+  context.started = true;
+  if(context.end && (strcmp(scriptName, "-i") == 0 || asyncOutput || verifySparseScan)) {
+    std::cerr << "Error: " << (asyncOutput ? "--async-output" : verifySparseScan ? "--verify-sparse-scan" : "-i")
+      << " can't be used with more than one simulation at once" << std::endl;
+    return false;
+  }
+  if(strcmp(scriptName, "-i") == 0) {
+    if(verifySparseScan) {
+      std::cerr << "Error: --verify-sparse-scan needs a script" << std::endl;
+      return false;
+    }
+    if(eventInput) {
+      std::cerr << "Error: event scripts can't be interactive" << std::endl;
+      return false;
+    }
+    if(lazyReports || asyncOutput) {
+      std::cerr << "Error: " << (lazyReports ? "--lazy-reports" : "--async-output") << " needs a script" << std::endl;
+      return false;
+    }
+    context.interactive = true;
+    context.input = &std::cin;
   } else {
-    interactive = false;
-    input = new std::ifstream(argv[1]);
-    if(!input || !(*input)) {
-      std::cerr << "Error opening input file \"" << argv[1] << "\"" << std::endl;
+    context.interactive = false;
+    if(!openScript(scriptName)) return false;
+    if(eventInput && context.frameInput) {
+      std::cerr << "Error: \"" << scriptName << "\" is a frame script, not an event script" << std::endl;
       return false;
     }
   }
 
-  if(mkdir("results", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
-    std::cerr << "Error creating directory 'results', errno " << errno << std::endl;
+  if(mkdir(resultsDirectory(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    std::cerr << "Error creating directory '" << resultsDirectory() << "', errno " << errno << std::endl;
     return false;
   }
-  usbstream = new std::ofstream("results/USB.txt");
+  if(verifySparseScan && !startReference()) return false;
+  // The writer thread is started after the reference process is forked, so each has its own
+  if(asyncOutput) {
+    if(!startAsyncOutput()) return false;
+    std::cout.rdbuf(openAsyncStreambuf(STDOUT_FILENO));
+  }
+  if(isReference) return true;
+  if(binaryUSBLog) return openBinaryUSBLog((std::string(resultsDirectory()) + "/USB.bin").c_str());
+  std::string usbLog = std::string(resultsDirectory()) + "/USB.txt";
+  if(asyncOutput) {
+    int fd = open(usbLog.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+      std::cerr << "Error opening '" << usbLog << "', errno " << errno << std::endl;
+      return false;
+    }
+    context.usbstream = new std::ostream(openAsyncStreambuf(fd));
+  } else {
+    context.usbstream = new std::ofstream(usbLog);
+  }
 
   return true;
 }
 
-std::string getLineOfInput(bool anythingHeld) {
+void closeInput(void) {
+  VirtualContext &context = *virtualContext;
+  if(context.scriptOnHeap) free((void*)context.script);
+  else if(context.script && context.scriptEnd != context.script) munmap((void*)context.script, context.scriptEnd - context.script);
+  context.scriptOnHeap = false;
+  context.script = context.scriptPos = context.scriptEnd = NULL;
+  context.frames = NULL;
+  context.frameCount = context.frameIndex = 0;
+  context.frameRepeatsLeft = 0;
+}
+
+bool continueScript(const char* scriptName) {
+  VirtualContext &context = *virtualContext;
+  bool frameInput = context.frameInput;
+  MatrixFrameHeader header = context.frameInputHeader;
+  context.frameInput = false;
+  if(!openScript(scriptName)) return false;
+  if(context.frameInput != frameInput
+      || (frameInput && (header.rows != context.frameInputHeader.rows || header.cols != context.frameInputHeader.cols))) {
+    std::cerr << "Error: \"" << scriptName << "\" isn't the same kind of script as the one before it" << std::endl;
+    closeInput();
+    return false;
+  }
+  return true;
+}
+
+void closeScript(void) {
+  VirtualContext &context = *virtualContext;
+  closeInput();
+  delete context.usbstream;
+  closeBinaryUSBLog();
+  while(context.resultsFileCount) closeResultsFile(context.resultsFiles[0]);
+}
+
+// Reads all of 'fd' into a buffer on the heap (to be freed with free()), for input that
+// can't be mapped.  Returns NULL on a read error.
+static char* readWhole(int fd, size_t &size) {
+  size_t capacity = 65536;
+  char* buffer = (char*) malloc(capacity);
+  size = 0;
+  while(buffer) {
+    if(size == capacity) {
+      char* grown = (char*) realloc(buffer, capacity *= 2);
+      if(!grown) break;
+      buffer = grown;
+    }
+    ssize_t got = read(fd, buffer + size, capacity - size);
+    if(got == 0) return buffer;
+    if(got < 0 && errno == EINTR) continue;
+    if(got < 0) break;
+    size += got;
+  }
+  free(buffer);
+  return NULL;
+}
+
+bool openScript(const char* filename) {
+  VirtualContext &context = *virtualContext;
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st)) {
+    std::cerr << "Error opening input file \"" << filename << "\"" << std::endl;
+    if(fd >= 0) close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  const char* script;
+  context.scriptOnHeap = !S_ISREG(st.st_mode);
+  if(context.scriptOnHeap) {
+    // A pipe or FIFO ("cat s.txt | sim /dev/stdin", "sim <(...)") can't be mapped, and its
+    // size isn't known until it has been read to the end
+    script = readWhole(fd, size);
+    if(!script) {
+      std::cerr << "Error reading input file \"" << filename << "\", errno " << errno << std::endl;
+      close(fd);
+      return false;
+    }
+  } else if(size == 0) {
+    script = "";
+  } else {
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+      std::cerr << "Error mapping input file \"" << filename << "\", errno " << errno << std::endl;
+      close(fd);
+      return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    script = (const char*) map;
+  }
+  close(fd);
+  context.script = script;
+  context.scriptPos = script;
+  context.scriptEnd = script + size;
+
+  // Binary frame scripts are recognized by their header; anything else is a text script
+  if(size >= sizeof(MatrixFrameHeader) && memcmp(script, MATRIX_FRAME_MAGIC, 4) == 0) {
+    MatrixFrameHeader &header = context.frameInputHeader;
+    memcpy(&header, script, sizeof(header));
+    if(header.version != MATRIX_FRAME_VERSION) {
+      std::cerr << "Error: unsupported frame script version " << (unsigned)header.version << std::endl;
+      return false;
+    }
+    context.frameInput = true;
+    context.frames = (const uint64_t*) (script + sizeof(MatrixFrameHeader));
+    context.frameWords = 2 * matrixFrameWords(header.rows, header.cols) + 1;
+    context.frameCount = (size - sizeof(MatrixFrameHeader)) / (context.frameWords * sizeof(uint64_t));
+  }
+  return true;
+}
+
+bool readLineOfInput(InputSlice& line) {
+  VirtualContext &context = *virtualContext;
+  if(context.interactive) {
+    // std::getline() reuses the string's buffer, so this only allocates while the
+    // longest line seen so far is growing
+    static std::string buffer;
+    if(!std::getline(*context.input, buffer)) return false;
+    line.data = buffer.data();
+    line.length = buffer.length();
+    return true;
+  }
+  const char* scriptPos = context.scriptPos;
+  const char* scriptEnd = context.scriptEnd;
+  if(scriptPos == scriptEnd) return false;
+  const char* newline = (const char*) memchr(scriptPos, '\n', scriptEnd - scriptPos);
+  if(!newline) newline = scriptEnd;
+  line.data = scriptPos;
+  line.length = newline - scriptPos;
+  context.scriptPos = (newline == scriptEnd) ? scriptEnd : newline + 1;
+  return true;
+}
+
+InputSlice getLineOfInput(bool anythingHeld) {
+  bool interactive = virtualContext->interactive;
   if(interactive) {
     std::cout << "Enter a command for this scan cycle, or ? or 'help' for help." << std::endl;
     if(anythingHeld) std::cout << "+> ";
     else std::cout << "> ";
   }
-  std::string line;
-  std::getline(*input, line);
-  if(!interactive && !(*input)) exit(0);  // reached EOF or other file error
+  InputSlice line = { "", 0 };
+  if(!readLineOfInput(line) && !interactive) endOfScript();  // reached EOF or other file error
   return line;
 }
 
+void setEndOfScriptHook(EndOfScriptHook hook) { virtualContext->endOfScriptHook = hook; }
+
+void endOfScript(void) {
+  if(virtualContext->endOfScriptHook) virtualContext->endOfScriptHook();
+  endSimulation(0);
+}
+
+void endSimulation(int status) {
+  // setjmp() returns 0 when first called, so the status is passed on plus one
+  if(virtualContext->end) longjmp(*virtualContext->end, status + 1);
+  exit(status);
+}
+
+bool isFrameInput(void) { return virtualContext->frameInput; }
+bool isEventInput(void) { return eventInput; }
+unsigned long scanPeriodMicros(void) { return scanPeriod; }
+unsigned long hostPollMicros(void) { return hostPoll; }
+unsigned hostQueueDepth(void) { return hostQueue; }
+bool isHostDropOnOverflow(void) { return hostDrop; }
+bool isLatencyAnalysis(void) { return latencyAnalysis; }
+bool isForkServer(void) { return forkServer; }
+bool isSuffixRun(void) { return suffixes; }
+bool isMinimizing(void) { return minimize; }
+bool isVerifySparseScan(void) { return verifySparseScan; }
+bool isMouseTrajectory(void) { return mouseTrajectory; }
+
+bool checkFrameInputGeometry(uint8_t rows, uint8_t cols) {
+  const MatrixFrameHeader &header = virtualContext->frameInputHeader;
+  if(header.rows != rows || header.cols != cols) {
+    std::cerr << "Error: frame script is for a " << (unsigned)header.rows << "x"
+      << (unsigned)header.cols << " matrix, but this keyboard is "
+      << (unsigned)rows << "x" << (unsigned)cols << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The 'repeat' field of a frame of 'words' words
+static uint32_t frameRepeat(const uint64_t* frame, size_t words) {
+  uint32_t repeat;
+  memcpy(&repeat, &frame[words - 1], sizeof(repeat));
+  return repeat;
+}
+
+void getFrameOfInput(const uint64_t*& held, const uint64_t*& tap) {
+  VirtualContext &context = *virtualContext;
+  size_t words = context.frameWords;
+  while(context.frameRepeatsLeft == 0) {
+    if(context.frameIndex == context.frameCount) endOfScript();
+    context.frameRepeatsLeft = frameRepeat(context.frames + words * context.frameIndex++, words);
+  }
+  context.frameRepeatsLeft--;
+  held = context.frames + words * (context.frameIndex-1);
+  tap = held + words / 2;
+}
+
+bool openFrameOutput(const char* filename, uint8_t rows, uint8_t cols) {
+  frameOutput = fopen(filename, "wb");
+  if(!frameOutput) {
+    std::cerr << "Error opening output file \"" << filename << "\"" << std::endl;
+    return false;
+  }
+  MatrixFrameHeader header;
+  memcpy(header.magic, MATRIX_FRAME_MAGIC, 4);
+  header.version = MATRIX_FRAME_VERSION;
+  header.rows = rows;
+  header.cols = cols;
+  header.reserved = 0;
+  fwrite(&header, sizeof(header), 1, frameOutput);
+  pendingFrame.assign(2 * matrixFrameWords(rows, cols) + 1, 0);
+  return true;
+}
+
+void putFrameOfOutput(const uint64_t* held, const uint64_t* tap, uint32_t repeat) {
+  size_t words = pendingFrame.size();
+  size_t keyWords = words / 2;
+  uint32_t pendingRepeat = frameRepeat(&pendingFrame[0], words);
+  if(pendingRepeat && pendingRepeat <= UINT32_MAX - repeat
+      && memcmp(&pendingFrame[0], held, keyWords * sizeof(uint64_t)) == 0
+      && memcmp(&pendingFrame[keyWords], tap, keyWords * sizeof(uint64_t)) == 0) {
+    pendingFrame[words - 1] = pendingRepeat + repeat;
+    return;
+  }
+  if(pendingRepeat) fwrite(&pendingFrame[0], sizeof(uint64_t), words, frameOutput);
+  memcpy(&pendingFrame[0], held, keyWords * sizeof(uint64_t));
+  memcpy(&pendingFrame[keyWords], tap, keyWords * sizeof(uint64_t));
+  pendingFrame[words - 1] = repeat;
+}
+
+bool closeFrameOutput(void) {
+  if(frameRepeat(&pendingFrame[0], pendingFrame.size())) {
+    fwrite(&pendingFrame[0], sizeof(uint64_t), pendingFrame.size(), frameOutput);
+  }
+  bool ok = !ferror(frameOutput);
+  fclose(frameOutput);
+  frameOutput = NULL;
+  return ok;
+}
+
 void printHelp(void) {
   std::cout << "\nUsage:\n" << std::endl;
   std::cout << "(Running with no arguments or with the argument '?' will print this help message and quit.)\n" << std::endl;
-  std::cout << "This program expects a single argument, which is either:" << std::endl;
+  std::cout << "This program expects a single argument (after any options), which is either:" << std::endl;
   std::cout << "  1. An input file/script, with format given below, or" << std::endl;
   std::cout << "  2. \"-i\", to run interactively, where you can interactively enter commands and see results." << std::endl;
+  std::cout << "Alternatively, \"-c script.txt script.kvmf\" converts a text script into a binary 'matrix frame'" << std::endl;
+  std::cout << "  script and quits.  Frame scripts can be given as the input file just like text scripts, and" << std::endl;
+  std::cout << "  are much faster to run; they hold the full key state of each scan cycle, with identical" << std::endl;
+  std::cout << "  consecutive cycles stored only once." << std::endl;
+  std::cout << "Or, \"-r SCRIPT_OR_DIR...\" runs many scripts (every file in each directory given) in" << std::endl;
+  std::cout << "  parallel, longest first, one process per script and up to --jobs at a time.  Each script's" << std::endl;
+  std::cout << "  results, stdout and stderr go to results/<script name>, and a summary of how each one" << std::endl;
+  std::cout << "  ended to results/summary.txt.  The exit status is 1 if any script failed." << std::endl;
+  std::cout << "Or, \"--fork-server\" (with no script) runs setup() once, then reads script filenames from" << std::endl;
+  std::cout << "  stdin, one per line (optionally followed by a tab and a results directory for it), and runs" << std::endl;
+  std::cout << "  each in a child process forked from the set-up sketch.  After each one, a line on stdout" << std::endl;
+  std::cout << "  says how it ended: \"ok\", \"exit N\" or \"signal N\".  Each script's stdout and stderr go to" << std::endl;
+  std::cout << "  stdout.txt in its results directory, and the output of setup() to results/setup.txt." << std::endl;
+  std::cout << "Or, \"--suffixes=SCRIPT_OR_DIR PREFIX\" runs the script PREFIX to its end once, snapshots the" << std::endl;
+  std::cout << "  whole simulation there, and then runs each suffix script (every file in a directory) on" << std::endl;
+  std::cout << "  from that snapshot, as if it had been appended to PREFIX.  Each suffix's results start with" << std::endl;
+  std::cout << "  a copy of the prefix's, and go to results/<suffix name> along with its stdout and stderr;" << std::endl;
+  std::cout << "  the summary is in results/summary.txt, and the exit status is 1 if any suffix failed." << std::endl;
+  std::cout << "  The suffixes all run in this one process, so a crash in any of them ends the run." << std::endl;
+  std::cout << "Or, \"--minimize SCRIPT\" shrinks a text script whose EXPECT fails to a minimal one that" << std::endl;
+  std::cout << "  still fails the same EXPECT, with the same keys on the host (with \"--minimize=crash\", one" << std::endl;
+  std::cout << "  that still crashes with the same signal), by delta debugging over its lines and then the" << std::endl;
+  std::cout << "  commands in them; EXPECT lines are kept.  setup() runs once, and each candidate in a child" << std::endl;
+  std::cout << "  process forked from there.  The result is written to results/minimized.txt, and its" << std::endl;
+  std::cout << "  output to results/minimize/stdout.txt." << std::endl;
+  std::cout << "Or, \"-d results/USB.bin\" prints a binary USB log (see --usb-log) in the text log's format" << std::endl;
+  std::cout << "  and quits." << std::endl;
+  std::cout << "\nOptions, given before the script:" << std::endl;
+  std::cout << "  -q, --verbosity=N   How much to print: 0 (same as -q) is nothing but errors in the script," << std::endl;
+  std::cout << "                      1 adds HID reports, and 2 (the default) adds the start of each cycle." << std::endl;
+  std::cout << "                      The USB and serial logs in \"results\" are written either way." << std::endl;
+  std::cout << "  --jobs=N            With -r, how many scripts to run at once (default: one per core)" << std::endl;
+  std::cout << "  --events            The script is a timed event script (see section 3 below)" << std::endl;
+  std::cout << "  --scan-period=US    Virtual time between scan cycles, in microseconds (default 1000)" << std::endl;
+  std::cout << "                      Virtual time (as seen by millis() and micros()) advances by this much" << std::endl;
+  std::cout << "                      every scan cycle, plus whatever the firmware passes to delay()." << std::endl;
+  std::cout << "  --sparse-scan       Only send keyswitch events for keys that are pressed or were pressed in" << std::endl;
+  std::cout << "                      the previous scan, rather than for every key in every scan.  Much faster," << std::endl;
+  std::cout << "                      but only correct if no plugin relies on events for idle keys." << std::endl;
+  std::cout << "  --verify-sparse-scan  Like --sparse-scan, but also runs the script with full scans in a" << std::endl;
+  std::cout << "                      second process, and stops with an error at the first difference" << std::endl;
+  std::cout << "                      between the two runs' HID reports." << std::endl;
+  std::cout << "  --async-output      Write stdout and the results files from a separate thread, so the" << std::endl;
+  std::cout << "                      simulation never waits on the terminal or the disk." << std::endl;
+  std::cout << "  --lazy-reports      Don't print or log keyboard reports as they are sent; just keep them, and" << std::endl;
+  std::cout << "                      print and log them all when the program ends (or aborts)." << std::endl;
+  std::cout << "  --usb-log=FORMAT    Log raw HID reports as 'text' (the default, results/USB.txt), or as" << std::endl;
+  std::cout << "                      'binary' (results/USB.bin), which is far smaller and faster to write." << std::endl;
+  std::cout << "  --latency           Measure the scan cycles and virtual time from each key press and release" << std::endl;
+  std::cout << "                      to the keyboard report that shows it, and write the distribution per key" << std::endl;
+  std::cout << "                      and per layer to results/latency.txt at exit." << std::endl;
+  std::cout << "  --mouse-trajectory  Record the cursor and wheel position, integrated from the mouse reports," << std::endl;
+  std::cout << "                      for each virtual millisecond with any mouse reports, in" << std::endl;
+  std::cout << "                      results/mouse_trajectory.txt, instead of printing and logging them." << std::endl;
+  std::cout << "  --host-poll=US      Model a USB host that polls each HID endpoint every US microseconds of" << std::endl;
+  std::cout << "                      virtual time (1000 for a full-speed 1 kHz host).  Reports wait in each" << std::endl;
+  std::cout << "                      endpoint's queue until polled; at exit, prints how many were coalesced," << std::endl;
+  std::cout << "                      dropped or delayed on each interface, and the latency they paid." << std::endl;
+  std::cout << "  --host-queue=N      With --host-poll, how many reports each endpoint can hold (default 1)" << std::endl;
+  std::cout << "  --host-overflow=X   With --host-poll, what happens to a report sent to a full endpoint:" << std::endl;
+  std::cout << "                      'coalesce' (the default) replaces the newest queued report with it (mouse" << std::endl;
+  std::cout << "                      movement is added up), and 'drop' throws it away." << std::endl;
+  std::cout << "  --skip-idle=N       Once no keys are held and the HID reports haven't changed for N cycles," << std::endl;
+  std::cout << "                      jump the clock straight to the next scripted input (the end of a 'W' wait," << std::endl;
+  std::cout << "                      or the next event of an event script).  Only use this if no plugin in the" << std::endl;
+  std::cout << "                      sketch is waiting on a timer while idle, or if the sketch says when via" << std::endl;
+  std::cout << "                      setIdleSkipPolicy()." << std::endl;
   std::cout << "\nIn either case, for each scan cycle you will specify zero or more input 'commands', that is," << std::endl;
   std::cout << "  actions to take on the keys of the virtual keyboard.  Each line of the input file, or each" << std::endl;
   std::cout << "  prompt (in interactive mode), represents one scan cycle; a blank line or empty prompt means" << std::endl;
@@ -103,8 +991,16 @@ void printHelp(void) {
   std::cout << "  Kaleidoscope sketch may or may not be doing.  As an exception to the printed-name rule, we" << std::endl;
   std::cout << "  distinguish physical keys with the same text (ctrl, shift, and fn) with 'l' or 'r' indicating the hand." << std::endl;
   std::cout << "Here is a list of all the valid key \"physical\" names:" << std::endl;
-  std::cout << "  prog 1 2 3 4 5 led any 6 7 8 9 0 num ` q w e r t y u i o p = pgup a s d f g tab enter h j k l ; '" << std::endl;
-  std::cout << "  pgdn z x c v b esc fly n m , . / - lctrl bksp cmd lshift lfn rshift alt space rctrl rfn" << std::endl;
+  std::string keynames = " ";
+#define PHYSICAL_KEY(name, row, col) \
+  if(keynames.length() + sizeof(name) > 96) { \
+    std::cout << keynames << std::endl; \
+    keynames = " "; \
+  } \
+  keynames = keynames + " " + name;
+  FOREACH_PHYSICAL_KEY(PHYSICAL_KEY)
+#undef PHYSICAL_KEY
+  std::cout << keynames << std::endl;
   std::cout << "The comment character '#' instructs the program to ignore the rest of the line (either in the" << std::endl;
   std::cout << "  script, or in interactive mode)." << std::endl;
   std::cout << "\nExample script:" << std::endl;
@@ -128,6 +1024,14 @@ void printHelp(void) {
   std::cout << "Commands affect all following keys within the line unless overridden. So, \"D lshift u\" holds" << std::endl;
   std::cout << "  both lshift and u. To hold lshift and tap u, either enter \"D lshift T u\", or \"u D lshift\"." << std::endl;
   std::cout << "An exception to the above rule is the command 'C', which releases all currently held keys." << std::endl;
+  std::cout << "Also an exception is 'W', which takes a number of cycles: \"W 500\" runs this cycle and the" << std::endl;
+  std::cout << "  following 499 with the currently held keys and no further input.  This is much faster than" << std::endl;
+  std::cout << "  the equivalent 499 blank lines, and is handy for waiting out timeouts." << std::endl;
+  std::cout << "'EXPECT' checks the keyboard reports, and takes up the rest of the line.  \"EXPECT keys lshift e\"" << std::endl;
+  std::cout << "  says the host must see exactly lshift and e pressed at the end of this cycle, as named in the" << std::endl;
+  std::cout << "  printed reports; \"EXPECT none\" says no keys; and \"EXPECT within 5 cycles keys a\" says the" << std::endl;
+  std::cout << "  host must see just 'a' at some point by the end of the fifth cycle after this one.  A script" << std::endl;
+  std::cout << "  stops at the first EXPECT that isn't met, with exit status 1 and the last few reports." << std::endl;
   std::cout << "One final command, 'Q', will quit the program.  In non-interactive mode (i.e. with an input" << std::endl;
   std::cout << "  script), the end of the script also implicitly indicates the end of the program." << std::endl;
   std::cout << "\nAdvanced script example:" << std::endl;
@@ -137,9 +1041,24 @@ void printHelp(void) {
   std::cout << "  D alt        # hold alt (in addition to lshift)" << std::endl;
   std::cout << "  U lshift T e # Release lshift, and tap e in the same cycle" << std::endl;
   std::cout << "               # Do nothing for a scan cycle (but keep alt held)" << std::endl;
+  std::cout << "  W 100        # Do nothing for 100 scan cycles (still keeping alt held)" << std::endl;
   std::cout << "  C            # Release all held keys (in this case, just alt)" << std::endl;
   std::cout << "  enter D (1,12) # Tap the physical enter key, and hold the key at (1,12)" << std::endl;
   std::cout << "  fly          # Tap the fly key (with (1,12) held)" << std::endl;
   std::cout << "  Q            # Quit the program" << std::endl;
+  std::cout << "\n3. TIMED EVENT SCRIPTS\n" << std::endl;
+  std::cout << "With --events, each line of the script instead gives key events and the virtual time at which" << std::endl;
+  std::cout << "  they happen; the events take effect at the first scan cycle at or after that time, so a" << std::endl;
+  std::cout << "  script needs no lines for the cycles in between.  Lines need not be in time order." << std::endl;
+  std::cout << "Events are '+key' (press and hold), '-key' (release), and 'tap key', followed by '@time'." << std::endl;
+  std::cout << "  Times may be in us, ms (the default), or s, and may have a fractional part.  The script" << std::endl;
+  std::cout << "  ends after its last event; an 'end @time' line runs it until that time instead." << std::endl;
+  std::cout << "\nEvent script example:" << std::endl;
+  std::cout << "  +lshift @12.5ms  # press lshift at 12.5 milliseconds" << std::endl;
+  std::cout << "  tap e @20ms      # tap e (with lshift still held)" << std::endl;
+  std::cout << "  -lshift @40ms    # release lshift" << std::endl;
+  std::cout << "  +a +s @1s        # press both a and s at one second" << std::endl;
+  std::cout << "  -a -s @1200ms" << std::endl;
+  std::cout << "  end @2s          # keep running until two seconds" << std::endl;
   std::cout << std::endl;
 }
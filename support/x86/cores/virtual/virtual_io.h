@@ -1,15 +1,151 @@
+#pragma once
+
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string>
+#include <ostream>
 
 // Returns TRUE if successful, FALSE if not
 bool initVirtualInput(int argc, char* argv[]);
+// Opens the script (or "-i" for interactive input), the results directory and the USB log,
+// ready to run.  initVirtualInput() calls this, except under --fork-server.
+bool startScript(const char* scriptName);
+
+// A line of input, or a token within one.  Points directly into the input buffer,
+// so it is not NUL-terminated and is only valid until the next line is read.
+typedef struct {
+  const char* data;
+  size_t length;
+} InputSlice;
+
+inline std::ostream& operator<<(std::ostream& os, const InputSlice& slice) {
+  return os.write(slice.data, slice.length);
+}
 
-std::string getLineOfInput(bool anythingHeld);
+bool openScript(const char* filename);  // Returns TRUE if successful, FALSE if not
+bool readLineOfInput(InputSlice& line);  // Returns FALSE at the end of input
+InputSlice getLineOfInput(bool anythingHeld);  // exits at the end of a script
 bool isInteractive(void);
+bool isEndOfInput(void);  // TRUE if the next scan cycle would find the end of the script
+
+// For --suffixes.  closeInput() unmaps the script, once it has been used up, and
+// continueScript() opens another in its place, which must be of the same kind (text or
+// frames), to go on from there as if it had been appended to it.
+void closeInput(void);
+bool continueScript(const char* scriptName);  // Returns TRUE if successful, FALSE if not
+
+// The end of the script (or 'Q'): runs the end-of-script hook, if any, then ends the
+// simulation with status 0 (see endSimulation() in simulation.h)
+void endOfScript(void) __attribute__((noreturn));
+typedef void (*EndOfScriptHook)(void);
+void setEndOfScriptHook(EndOfScriptHook hook);
+
+bool isEventInput(void);  // TRUE if the input script is a timed event script
+unsigned long scanPeriodMicros(void);  // virtual time between scan cycles
+
+// The USB host model (--host-poll, --host-queue, --host-overflow)
+#define MAX_HOST_QUEUE 16
+unsigned long hostPollMicros(void);  // virtual time between polls of each endpoint; 0 if there is no host model
+unsigned hostQueueDepth(void);  // reports each endpoint can hold
+bool isHostDropOnOverflow(void);  // TRUE to drop a report sent to a full endpoint, FALSE to coalesce it
+
+// How much is printed to stdout (-q, --verbosity=N).  This is a plain global so that print
+// sites can check it before doing any formatting.
+#define VERBOSITY_SILENT 0  // nothing but errors in the script
+#define VERBOSITY_REPORTS 1  // HID reports
+#define VERBOSITY_CYCLES 2  // HID reports and the start of each scan cycle (the default)
+extern uint8_t virtualVerbosity;
+
+bool isSparseScan(void);  // TRUE if scans should only visit keys that are or were pressed
+bool isLazyReports(void);  // TRUE if keyboard reports should only be rendered as text at exit
+bool isForkServer(void);  // TRUE if scripts come from runForkServer() (--fork-server)
+bool isSuffixRun(void);  // TRUE if the script is a prefix for runSuffix() (--suffixes)
+bool isMinimizing(void);  // TRUE if the script is to be minimized by minimizeScript() (--minimize)
+bool isVerifySparseScan(void);  // TRUE if a reference process checks the sparse scans (--verify-sparse-scan)
+bool isLatencyAnalysis(void);  // TRUE if key-to-report latency should be measured (--latency)
+bool isMouseTrajectory(void);  // TRUE if the mouse trajectory should be recorded (--mouse-trajectory)
 void printHelp(void);
 
+// Binary "matrix frame" scripts.  The file starts with a MatrixFrameHeader, followed
+// by any number of frames.  Each frame describes one scan cycle: 'held' is the complete
+// set of keys held down during that cycle, and 'tap' is the set of keys tapped in that
+// cycle, each a set of matrixFrameWords() 64-bit words where key (row,col) is bit
+// (row*cols + col).  They are followed by a 32-bit 'repeat', the number of consecutive
+// cycles that frame describes (so idle stretches cost one frame), and 32 reserved bits.
+#define MATRIX_FRAME_MAGIC "KVMF"
+#define MATRIX_FRAME_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint8_t version;
+  uint8_t rows;
+  uint8_t cols;
+  uint8_t reserved;
+} MatrixFrameHeader;
+
+inline size_t matrixFrameWords(uint8_t rows, uint8_t cols) { return (rows*cols + 63) / 64; }
+
+bool isFrameInput(void);  // TRUE if the input script is a binary matrix-frame script
+bool checkFrameInputGeometry(uint8_t rows, uint8_t cols);
+// Points 'held' and 'tap' at the current frame's sets; exits at the end of the script
+void getFrameOfInput(const uint64_t*& held, const uint64_t*& tap);
+
+bool openFrameOutput(const char* filename, uint8_t rows, uint8_t cols);
+// Identical consecutive frames are merged
+void putFrameOfOutput(const uint64_t* held, const uint64_t* tap, uint32_t repeat = 1);
+bool closeFrameOutput(void);
+
+// Converts a text script to a binary matrix-frame script.  The script syntax belongs to
+// the hardware, so this is implemented there and not in virtual_io.cpp.
+bool convertScript(const char* textfile, const char* framefile);
+// For the minimizer (--minimize): splits the next command off the front of a line of a text
+// script, as 'command'.  That is a key, a T, D, U, C or Q, or a W with its count, any of
+// which the minimizer may drop; or an EXPECT with the rest of the line, which it keeps, and
+// for which 'expectation' is set.  Returns FALSE at the end of the line, or a comment.  Also
+// implemented by the hardware.
+bool nextScriptCommand(InputSlice &line, InputSlice &command, bool &expectation);
+
 unsigned currentCycle(void);  // current cycle number, first cycle is 0
 void nextCycle(void);  // should only be used by cores/virtual/main.cpp, to increment currentCycle()
 
-void logUSBEvent(std::string descrip, void* data, int length);
-void logUSBEvent_keyboard(std::string descrip);  // assumes 'descrip' uniquely describes the raw data too
+// Idle fast-forward (the 'W' command): the next 'cycles' scan cycles take no input, leaving
+// held keys held, and skip the per-cycle console output
+void addIdleCycles(unsigned cycles);
+bool isIdleCycle(void);  // TRUE if the current cycle is one of those
+bool takeIdleCycle(void);  // Returns FALSE if the current cycle should read input as usual
+
+// Quiescence skipping (--skip-idle=N).  Once no keys are held and no HID report has changed
+// for N cycles, the hardware may jump the clock and cycle counter straight to the next
+// scripted input.  That is only safe if no plugin is waiting on time (a timeout, an LED
+// effect), so the sketch can register a policy which returns TRUE only when that is so;
+// without one, giving --skip-idle asserts that it always is.
+typedef bool (*IdleSkipPolicy)(void);
+void setIdleSkipPolicy(IdleSkipPolicy policy);
+bool canSkipIdleCycles(void);
+void skipIdleCycles(unsigned cycles);  // the next 'cycles' cycles after this one never happen
+void skipRestOfIdleCycles(void);  // the same, for the rest of a 'W' wait
+
+// Opens the named file in the results directory for writing
+FILE* openResultsFile(const char* name);
+void closeResultsFile(FILE* file);
+void setResultsDirectory(const char* directory);  // "results" unless running under -r or --fork-server
+// In a child forked from a process that has run the sketch's setup(): reopens every
+// results file opened so far (by setup(), say) under the same name in 'directory' (which
+// must exist), each starting out with a copy of what the parent had written to it, and
+// makes 'directory' the results directory.  A file in the parent's own directory is
+// appended to instead, leaving the parent's copy as it is.  Returns FALSE on error.
+bool reopenResultsFiles(const char* directory);
+// Moves every results file, and the USB log, to 'directory' (which must exist), each
+// starting out with a copy of what it holds so far.  Returns FALSE on error.
+bool moveResultsFiles(const char* directory);
+
+void logUSBEvent(const std::string &descrip, const void* data, int length);
+// 'descrip' is the report's text form for the text log; the binary log stores the raw report.
+// With --lazy-reports, 'descrip' is ignored, and the text log gets it later through
+// logDeferredUSBEvent_keyboard().
+void logUSBEvent_keyboard(const std::string &descrip, const void* data, int length);
+void logDeferredUSBEvent_keyboard(unsigned cycle, const std::string &descrip);
+bool isTextUSBLog(void);  // TRUE if logUSBEvent_keyboard() needs 'descrip' for the text log
+void flushUSBLog(void);
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Tests the minimizer (--minimize) with the example sketch, built for the virtual board:
+#   test/minimize/run.sh output/example/example-latest.elf
+# Each script here fails an EXPECT, and must be minimized to the script in its .expected
+# file.  Exits with status 0 if they all are, or 1 if not.
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 SKETCH_EXECUTABLE" >&2
+  exit 2
+fi
+sketch=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+failed=0
+for script in "$tests"/*.txt; do
+  name=$(basename "$script" .txt)
+  mkdir "$work/$name"
+  if ! (cd "$work/$name" && "$sketch" -q --minimize "$script" > /dev/null) \
+      || ! diff -u "$tests/$name.expected" "$work/$name/results/minimized.txt"; then
+    echo "FAILED: $name"
+    failed=1
+  fi
+done
+[ $failed -eq 0 ] && echo "ok"
+exit $failed
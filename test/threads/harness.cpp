@@ -0,0 +1,59 @@
+// A test of running simulations at once, each on a thread of its own.  Build this sketch
+// as "One per thread" (the FQBN keyboardio:x86:virtual:simulations=threads) and run it from
+// this directory.  passes.txt and fails.txt each hold down a different key for a while,
+// and expect to see only their own, so they fail if the threads share any keyboard state;
+// then fails.txt fails an EXPECT on purpose, which must end its own simulation and nothing
+// else.  Exits with status 0 if each ended as expected, or 1 if not.
+
+#include <Arduino.h>
+#include <thread>
+#include <iostream>
+#include <sys/stat.h>  // mkdir()
+#include <errno.h>
+#include "virtual_io.h"
+#include "simulation.h"
+
+#ifndef VIRTUAL_THREADS
+#error "This test runs simulations on threads, and needs the \"One per thread\" build (simulations=threads)"
+#endif
+
+typedef struct {
+  const char* script;
+  const char* resultsDirectory;
+  int expectedStatus;
+  int status;
+} Simulation;
+
+static Simulation simulations[] = {
+  { "passes.txt", "results/passes", 0, -1 },
+  { "fails.txt", "results/fails", 1, -1 },
+};
+#define SIMULATION_COUNT (sizeof(simulations) / sizeof(simulations[0]))
+
+static void run(Simulation* simulation) {
+  simulation->status = runSimulation(simulation->script, simulation->resultsDirectory);
+}
+
+int main(int argc, char* argv[]) {
+  // The simulations' stdout would be interleaved; each one's reports are in its USB.txt
+  virtualVerbosity = VERBOSITY_SILENT;
+  if(mkdir("results", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+    std::cerr << "Error creating directory 'results', errno " << errno << std::endl;
+    return 1;
+  }
+
+  std::thread threads[SIMULATION_COUNT];
+  for(size_t i = 0; i < SIMULATION_COUNT; i++) threads[i] = std::thread(run, &simulations[i]);
+  for(size_t i = 0; i < SIMULATION_COUNT; i++) threads[i].join();
+
+  bool ok = true;
+  for(size_t i = 0; i < SIMULATION_COUNT; i++) {
+    const Simulation &simulation = simulations[i];
+    if(simulation.status == simulation.expectedStatus) continue;
+    std::cerr << "Error: " << simulation.script << " ended with status " << simulation.status
+      << ", not " << simulation.expectedStatus << std::endl;
+    ok = false;
+  }
+  if(ok) std::cout << SIMULATION_COUNT << " simulations at once: ok" << std::endl;
+  return ok ? 0 : 1;
+}